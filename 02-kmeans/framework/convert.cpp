@@ -0,0 +1,100 @@
+#define _CRT_SECURE_NO_WARNINGS
+/*
+ * Conversion of point files between the supported formats (raw, headered, columnar, compressed, text).
+ */
+#include <exception.hpp>
+#include <interface.hpp>
+#include <mapped_file.hpp>
+#include <dataset.hpp>
+#include <compressed.hpp>
+#include <columnar.hpp>
+#include <text_points.hpp>
+
+#include <vector>
+#include <iostream>
+#include <string>
+#include <cstdint>
+#include <cstdio>
+
+
+
+void print_usage()
+{
+	std::cout << "Arguments: <input_file> <output_file> <format>" << std::endl;
+	std::cout << "  <input_file>       - points file (raw, with dataset header, compressed or text, detected automatically)" << std::endl;
+	std::cout << "  <output_file>      - file where the converted points are stored" << std::endl;
+	std::cout << "  <format>           - raw (array of point_t), int32 or int64 (dataset header), packed (compressed)," << std::endl;
+	std::cout << "                       int32-columns or int64-columns (columnar dataset header)" << std::endl;
+	std::cout << "                       split (raw columns in <output_file>.x and <output_file>.y) or csv (text)" << std::endl;
+}
+
+
+/*
+ * \brief Save points as a raw array of point_t records.
+ */
+void save_raw(const std::string &fileName, array_view<const point_t> points)
+{
+	std::FILE *fp = std::fopen(fileName.c_str(), "wb");
+	if (fp == nullptr)
+		throw (bpp::RuntimeError() << "File '" << fileName << "' cannot be opened for writing.");
+	bool ok = std::fwrite(points.data(), sizeof(point_t), points.size(), fp) == points.size();
+	std::fclose(fp);
+	if (!ok)
+		throw (bpp::RuntimeError() << "Error while writing data to file '" << fileName << "'.");
+}
+
+
+/*
+ * Application Entry Point
+ */
+int main(int argc, char **argv)
+{
+	if (argc != 4) {
+		print_usage();
+		return 0;
+	}
+
+	std::string format = argv[3];
+	try {
+		MappedFile input(argv[1]);
+		std::vector<point_t> storage;
+		array_view<const point_t> points;
+		if (is_text_file(argv[1])) {
+			parse_text_points(argv[1], input.view<char>().data(), input.size(), storage);
+			points = storage;
+		}
+		else if (compressed_header_t::matches(input.view<char>().data(), input.size())) {
+			decode_compressed(argv[1], input.view<char>().data(), input.size(), storage);
+			points = storage;
+		}
+		else
+			points = dataset_points(argv[1], input.view<char>().data(), input.size(), storage);
+
+		if (format == "raw")
+			save_raw(argv[2], points);
+		else if (format == "int32")
+			save_dataset(argv[2], points, dataset_header_t::INT32);
+		else if (format == "int64")
+			save_dataset(argv[2], points, dataset_header_t::INT64);
+		else if (format == "int32-columns")
+			save_dataset(argv[2], points, dataset_header_t::INT32, true);
+		else if (format == "int64-columns")
+			save_dataset(argv[2], points, dataset_header_t::INT64, true);
+		else if (format == "split")
+			save_split_columns(std::string(argv[2]) + ".x", std::string(argv[2]) + ".y", points);
+		else if (format == "csv")
+			save_text_points(argv[2], points);
+		else if (format == "packed")
+			save_compressed(argv[2], points);
+		else {
+			print_usage();
+			return 0;
+		}
+	}
+	catch (std::exception &e) {
+		std::cerr << "Error: " << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -3,22 +3,41 @@
 
 #include <interface.hpp>
 #include <exception.hpp>
+#include <stopwatch.hpp>
+#include <memory_usage.hpp>
 #include <math.h>
 #include <tbb/parallel_for.h>
 #include <tbb/parallel_reduce.h>
 #include <tbb/blocked_range.h>
 #include <tbb/concurrent_vector.h>
+#include <tbb/enumerable_thread_specific.h>
 #include <iostream>
+#include <limits>
+#include <type_traits>
 
 template<typename POINT = point_t, typename ASGN = std::uint8_t, bool DEBUG = false>
 class KMeans : public IKMeans<POINT, ASGN, DEBUG>
 {
+public:
+	// The copies of the points are the largest allocation, so they are counted (see memory_usage.hpp).
+	typedef tbb::concurrent_vector<POINT, counting_allocator<POINT, tbb::cache_aligned_allocator<POINT>>> cluster_points_t;
+
 private:
 	typedef typename POINT::coord_t coord_t;
 
-	std::vector<tbb::concurrent_vector<POINT>> temp_assignments;
+	std::vector<cluster_points_t> temp_assignments;
 	size_t POINTS_SIZE;
 
+	// Per-thread accumulators of the debug diagnostics and of the work counters (empty placeholders
+	// if disabled). They are members, so the regular build does not capture anything more in the loop bodies.
+	struct disabled_t {};
+	std::conditional_t<DEBUG, tbb::enumerable_thread_specific<iteration_diagnostics_t>, disabled_t> debug_diagnostics;
+	std::conditional_t<WORK_COUNTERS, tbb::enumerable_thread_specific<assignment_counters_t>, disabled_t> local_counters;
+	std::size_t debug_iteration = 0;
+
+
+public:
+	using IKMeans<POINT, ASGN, DEBUG>::compute;
 
 	static coord_t distance(const POINT &point, const POINT &centroid)
 	{
@@ -27,7 +46,7 @@ private:
 		return (coord_t)(dx*dx + dy*dy);
 	}
 
-	static std::size_t getNearestCluster(const POINT &point, const std::vector<POINT> &centroids)
+	static std::size_t getNearestCluster(const POINT &point, array_view<const POINT> centroids)
 	{
 		coord_t minDist = distance(point, centroids[0]);
 		std::size_t nearest = 0;
@@ -43,7 +62,118 @@ private:
 	}
 
 
-public:
+	/*
+	 * \brief Sum the coordinates of the points of one cluster (a parallel reduction).
+	 */
+	POINT sumCluster(const cluster_points_t &cluster) const
+	{
+		POINT result;
+		result.x = 0;
+		result.y = 0;
+		return tbb::parallel_reduce(tbb::blocked_range<size_t>(0, cluster.size()), result,
+		[&](const tbb::blocked_range<size_t> r, POINT p) {
+			TraceScope trace(this->mTrace, "sum", r.size());
+			WorkScope work(this->mWork, r.size());
+			for (std::size_t j = r.begin(); j < r.end(); ++j) {
+				p.x += cluster[j].x;
+				p.y += cluster[j].y;
+			}
+			return p;
+		}, [](POINT f, POINT s)->POINT {
+			f.x += s.x;
+			f.y += s.y;
+			return f;
+		});
+	}
+
+
+	/*
+	 * \brief Debug build tracks the assignments in every iteration to count the changes.
+	 */
+	void trackAssignment(iteration_diagnostics_t &diagnostics, const POINT &point, array_view<const POINT> centroids,
+		array_view<ASGN> assignments, std::size_t i, std::size_t nearest)
+	{
+		diagnostics.sse += (double)distance(point, centroids[nearest]);
+		diagnostics.reassigned += (debug_iteration == 0 || assignments[i] != (ASGN)nearest) ? 1 : 0;
+		assignments[i] = (ASGN)nearest;
+	}
+
+
+	/*
+	 * \brief Assign the points to their nearest centroids and copy them into the clusters.
+	 *		The range tracing and work statistics are compiled in only if INSTRUMENTED.
+	 * \param last Whether this is the final loop (the assignments are stored in the results).
+	 */
+	template<bool INSTRUMENTED>
+	void assignPoints(array_view<const POINT> points, array_view<const POINT> centroids, array_view<ASGN> assignments, bool last)
+	{
+		tbb::parallel_for(
+			tbb::blocked_range<size_t>(size_t(0), size_t(POINTS_SIZE)), 
+			[&](const tbb::blocked_range<size_t>range) {
+				TraceScope trace(INSTRUMENTED ? this->mTrace : nullptr, "assign", range.size());
+				WorkScope work(INSTRUMENTED ? this->mWork : nullptr, range.size());
+				iteration_diagnostics_t *diagnostics = nullptr;
+				if constexpr (DEBUG) diagnostics = &debug_diagnostics.local();
+				if constexpr (WORK_COUNTERS) local_counters.local().distances += range.size() * centroids.size();	// the search is exhaustive
+				for (size_t i = range.begin(); i != range.end(); ++i) {
+					std::size_t nearest = getNearestCluster(points[i], centroids);
+					if constexpr (DEBUG) trackAssignment(*diagnostics, points[i], centroids, assignments, i, nearest);
+
+					// Final loop, store in the results
+					if (last) assignments[i] = (ASGN)nearest;
+					temp_assignments[(ASGN)nearest].push_back(points[i]);
+				}
+		});
+	}
+
+
+	/*
+	 * \brief The final loop when the cluster statistics and/or the second-nearest centroids are requested
+	 *		(the per-thread statistics exist only here).
+	 */
+	void assignPointsFinal(array_view<const POINT> points, array_view<const POINT> centroids, array_view<ASGN> assignments)
+	{
+		std::size_t k = centroids.size();
+		bool collectStats = !this->mStats.empty();
+		bool trackSecond = !this->mSecond.empty();
+		tbb::enumerable_thread_specific<std::vector<cluster_stats_t>> localStats(std::vector<cluster_stats_t>(collectStats ? k : 0));
+
+		tbb::parallel_for(
+			tbb::blocked_range<size_t>(size_t(0), size_t(POINTS_SIZE)), 
+			[&](const tbb::blocked_range<size_t>range) {
+				TraceScope trace(this->mTrace, "assign", range.size());
+				WorkScope work(this->mWork, range.size());
+				std::vector<cluster_stats_t> *stats = collectStats ? &localStats.local() : nullptr;
+				iteration_diagnostics_t *diagnostics = nullptr;
+				if constexpr (DEBUG) diagnostics = &debug_diagnostics.local();
+				if constexpr (WORK_COUNTERS) local_counters.local().distances += range.size() * centroids.size();
+				for (size_t i = range.begin(); i != range.end(); ++i) {
+					std::size_t nearest;
+					if (trackSecond) {
+						std::size_t second;
+						nearest = get_nearest_clusters<POINT>(points[i], centroids, distance, second, this->mMargins[i]);
+						this->mSecond[i] = (ASGN)second;
+					}
+					else
+						nearest = getNearestCluster(points[i], centroids);
+					if constexpr (DEBUG) trackAssignment(*diagnostics, points[i], centroids, assignments, i, nearest);
+
+					assignments[i] = (ASGN)nearest;
+					if (stats) (*stats)[nearest].add(points[i], (std::uint64_t)distance(points[i], centroids[nearest]));
+					temp_assignments[(ASGN)nearest].push_back(points[i]);
+				}
+		});
+
+		if (collectStats) {
+			for (std::size_t i = 0; i < k; ++i) {
+				this->mStats[i].clear();
+				for (auto &stats : localStats)
+					this->mStats[i].merge(stats[i]);
+			}
+		}
+	}
+
+
 	/*
 	 * \brief Perform the initialization of the functor (e.g., allocate memory buffers).
 	 * \param points Number of points being clustered.
@@ -54,80 +184,127 @@ public:
 	{
 		POINTS_SIZE = points;
 		while (k--) {
-			temp_assignments.push_back(tbb::concurrent_vector<POINT> {});
+			temp_assignments.push_back(cluster_points_t {});
 		}
 	}
 
 
+	/*
+	 * \brief All the points are copied into the clusters, the concurrent vectors allocate segments
+	 *		of doubling sizes, so they may take up to twice the size of the points.
+	 */
+	virtual std::size_t memoryEstimate(std::size_t points, std::size_t k) const
+	{
+		return 2 * points * sizeof(POINT) + k * (sizeof(cluster_points_t) + sizeof(POINT));
+	}
+
+
+	/*
+	 * \brief Every point is read and written into the copy of its cluster in the assignment,
+	 *		and the copies are read again by the reduction (the assignments are stored only
+	 *		in the last iteration).
+	 */
+	virtual std::size_t iterationTraffic(std::size_t points, std::size_t k) const
+	{
+		return 3 * points * sizeof(POINT);
+	}
+
+
 	/*
 	 * \brief Perform the clustering and return the cluster centroids and point assignment
 	 *		yielded by the last iteration.
 	 * \note First k points are taken as initial centroids for first iteration.
-	 * \param points Vector with input points.
+	 * \param points View of the input points.
 	 * \param k Number of clusters.
 	 * \param iters Number of refining iterations.
-	 * \param centroids Vector where the final cluster centroids should be stored.
-	 * \param assignments Vector where the final assignment of the points should be stored.
-	 *		The indices should correspond to point indices in 'points' vector.
+	 * \param centroids Preallocated array (of size k) where the final cluster centroids should be stored.
+	 * \param assignments Preallocated array (of size points.size()) where the final assignment of
+	 *		the points should be stored. The indices should correspond to point indices in 'points' view.
 	 */
-	virtual void compute(const std::vector<POINT> &points, std::size_t k, std::size_t iters,
-		std::vector<POINT> &centroids, std::vector<ASGN> &assignments)
+	virtual void compute(array_view<const POINT> points, std::size_t k, std::size_t iters,
+		array_view<POINT> centroids, array_view<ASGN> assignments)
 	{
 		// Prepare for the first iteration
-		centroids.resize(k);
-		assignments.resize(points.size());
 		for (std::size_t i = 0; i < k; ++i) {
 			centroids[i] = points[i];
 		}
 
 		// Run the k-means refinements
+		std::vector<POINT> sums(k);
+		debug_iteration = 0;
+		this->mAssignmentCounters.clear();
 		while (iters > 0) {
 			--iters;
+			ScopedTimer iterationTimer(this->mTimers, "iteration");
+			bpp::Stopwatch iterationStopwatch;
+			if constexpr (DEBUG) {
+				iterationStopwatch.start();
+				debug_diagnostics.clear();
+			}
+			if constexpr (WORK_COUNTERS) local_counters.clear();
 
 			// Prepare empty tmp fields.
 			for (std::size_t i = 0; i < k; ++i) {
 				temp_assignments[i].clear();
 			}
 			
-			tbb::parallel_for(
-				tbb::blocked_range<size_t>(size_t(0), size_t(POINTS_SIZE)), 
-				[&](const tbb::blocked_range<size_t>range) {
-					for (size_t i = range.begin(); i != range.end(); ++i) {
-						std::size_t nearest = getNearestCluster(points[i], centroids);
-
-						// Final loop, store in the results
-						if (iters == 0) assignments[i] = (ASGN)nearest;
-						temp_assignments[(ASGN)nearest].push_back(points[i]);
-					}
-			});
-
-			tbb::parallel_for(
-				tbb::blocked_range<size_t>(size_t(0), size_t(k)), 
-				[&](const tbb::blocked_range<size_t>range) {
-					for (std::size_t i = range.begin(); i < range.end(); ++i) {
-						auto cluster_size = temp_assignments[i].size();
-						if (cluster_size == 0) continue;	
-
-						POINT result;
-						result.x = 0;
-						result.y = 0;
-						result = tbb::parallel_reduce(tbb::blocked_range<size_t>(0, cluster_size), result,
-						[&](const tbb::blocked_range<size_t> r, POINT p) {
-							for (std::size_t j = r.begin(); j < r.end(); ++j) {
-								p.x += temp_assignments[i][j].x; 
-								p.y += temp_assignments[i][j].y; 
-							}
-							return p;
-						}, [](POINT f, POINT s)->POINT {
-							f.x += s.x;
-							f.y += s.y;
-							return f;
-						});
-
-						centroids[i].x = result.x / (std::int64_t)cluster_size;
-						centroids[i].y = result.y / (std::int64_t)cluster_size;
-					}
-				});
+			{
+				ScopedTimer assignTimer(this->mTimers, "assign");
+				if (this->mWork) this->mWork->begin("assign");
+				// The statistics and the second-nearest centroids are gathered in a separate final pass,
+				// so the regular passes (and the regular build) run the plain loop.
+				if (iters == 0 && (!this->mStats.empty() || !this->mSecond.empty()))
+					assignPointsFinal(points, centroids, assignments);
+				else if (this->mTrace || this->mWork)
+					assignPoints<true>(points, centroids, assignments, iters == 0);
+				else
+					assignPoints<false>(points, centroids, assignments, iters == 0);
+				if (this->mWork) this->mWork->end();
+
+				if constexpr (WORK_COUNTERS) {
+					assignment_counters_t counters;
+					for (auto &local : local_counters)
+						counters.merge(local);
+					this->mAssignmentCounters.push_back(counters);
+				}
+			}
+
+			{
+				ScopedTimer reduceTimer(this->mTimers, "reduce");
+				if (this->mWork) this->mWork->begin("reduce");	// only the nested sums are recorded (they are the leaves)
+				tbb::parallel_for(
+					tbb::blocked_range<size_t>(size_t(0), size_t(k)), 
+					[&](const tbb::blocked_range<size_t>range) {
+						TraceScope trace(this->mTrace, "reduce", range.size());
+						for (std::size_t i = range.begin(); i < range.end(); ++i) {
+							auto cluster_size = temp_assignments[i].size();
+							if (cluster_size == 0) continue;	
+
+							sums[i] = sumCluster(temp_assignments[i]);
+						}
+					});
+				if (this->mWork) this->mWork->end();
+			}
+
+			ScopedTimer updateTimer(this->mTimers, "update");
+			iteration_diagnostics_t diagnostics;
+			for (std::size_t i = 0; i < k; ++i) {
+				auto cluster_size = temp_assignments[i].size();
+				if constexpr (DEBUG) diagnostics.emptyClusters += (cluster_size == 0) ? 1 : 0;
+				if (cluster_size == 0) continue;
+				POINT previous = centroids[i];
+				centroids[i].x = sums[i].x / (std::int64_t)cluster_size;
+				centroids[i].y = sums[i].y / (std::int64_t)cluster_size;
+				if constexpr (DEBUG) diagnostics.maxShift = std::max(diagnostics.maxShift, sqrt((double)distance(previous, centroids[i])));
+			}
+
+			if constexpr (DEBUG) {
+				for (auto &local : debug_diagnostics)
+					diagnostics.merge(local);
+				iterationStopwatch.stop();
+				diagnostics.time = iterationStopwatch.getMiliseconds();
+				diagnostics.print(std::cerr, debug_iteration++);
+			}
 		}
 	}
 };
@@ -0,0 +1,107 @@
+#ifndef KMEANS_FRAMEWORK_INTERNAL_CLUSTER_INDEX_HPP
+#define KMEANS_FRAMEWORK_INTERNAL_CLUSTER_INDEX_HPP
+
+#include <interface.hpp>
+#include <exception.hpp>
+#include <workers.hpp>
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+
+
+/*
+ * \brief Parallel counting sort of point indices by their clusters. The points are split
+ *		into fixed blocks, each block computes its own histogram, a prefix sum over
+ *		(cluster, block) pairs yields the position where every block writes its points of every
+ *		cluster, and the blocks are scattered concurrently. The sort is stable, so the members
+ *		of each cluster are listed in ascending order (the result does not depend on the threads).
+ */
+template<typename ASGN>
+class ClusterSort
+{
+private:
+	static const std::size_t BLOCK = 64*1024;
+
+	array_view<const ASGN> mAssignments;
+	std::size_t mK;
+	std::size_t mBlocks;
+	std::vector<std::uint64_t> mPositions;	///< Start of each (block, cluster) pair in the sorted order.
+
+	std::size_t blockEnd(std::size_t block) const
+	{
+		return std::min((block + 1) * BLOCK, mAssignments.size());
+	}
+
+public:
+	/*
+	 * \brief Compute the histograms and the positions (the first, counting phase).
+	 * \param assignments Cluster of every point.
+	 * \param k Number of clusters.
+	 * \param offsets Receives k+1 offsets, members of cluster c are at [offsets[c], offsets[c+1]).
+	 */
+	ClusterSort(array_view<const ASGN> assignments, std::size_t k, array_view<std::uint64_t> offsets)
+		: mAssignments(assignments), mK(k), mBlocks((assignments.size() + BLOCK - 1) / BLOCK)
+	{
+		if (offsets.size() != k + 1)
+			throw (bpp::RuntimeError() << "Cluster offsets must have " << k + 1 << " items.");
+
+		mPositions.assign(mBlocks * mK, 0);
+		run_tasks(mBlocks, [&](std::size_t block) {
+			std::uint64_t *histogram = &mPositions[block * mK];
+			for (std::size_t i = block * BLOCK; i < blockEnd(block); ++i)
+				++histogram[(std::size_t)mAssignments[i]];
+		});
+
+		// Exclusive prefix sum, cluster-major (all blocks of cluster 0 go first).
+		std::uint64_t sum = 0;
+		for (std::size_t c = 0; c < mK; ++c) {
+			offsets[c] = sum;
+			for (std::size_t block = 0; block < mBlocks; ++block) {
+				std::uint64_t count = mPositions[block * mK + c];
+				mPositions[block * mK + c] = sum;
+				sum += count;
+			}
+		}
+		offsets[mK] = sum;
+	}
+
+	/*
+	 * \brief Scatter items of the points into their sorted positions (the second phase).
+	 * \param store Functor (std::size_t position, std::size_t point) which stores one item.
+	 */
+	template<typename STORE>
+	void scatter(STORE store) const
+	{
+		run_tasks(mBlocks, [&](std::size_t block) {
+			std::vector<std::uint64_t> positions(mPositions.begin() + block * mK, mPositions.begin() + (block + 1) * mK);
+			for (std::size_t i = block * BLOCK; i < blockEnd(block); ++i)
+				store((std::size_t)positions[(std::size_t)mAssignments[i]]++, i);
+		});
+	}
+};
+
+
+/*
+ * \brief Build cluster membership in CSR form (offsets and point indices grouped by cluster).
+ * \param assignments Cluster of every point.
+ * \param k Number of clusters.
+ * \param offsets Array of k+1 items, members of cluster c are at indices[offsets[c] .. offsets[c+1]).
+ * \param indices Array of assignments.size() items which receives the point indices.
+ */
+template<typename ASGN>
+void build_cluster_index(array_view<const ASGN> assignments, std::size_t k,
+	array_view<std::uint64_t> offsets, array_view<std::uint64_t> indices)
+{
+	if (indices.size() != assignments.size())
+		throw (bpp::RuntimeError() << "Cluster index must have " << assignments.size() << " items.");
+
+	ClusterSort<ASGN> sort(assignments, k, offsets);
+	sort.scatter([&](std::size_t position, std::size_t point) {
+		indices[position] = (std::uint64_t)point;
+	});
+}
+
+
+#endif
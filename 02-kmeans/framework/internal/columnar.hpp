@@ -0,0 +1,73 @@
+#ifndef KMEANS_FRAMEWORK_INTERNAL_COLUMNAR_HPP
+#define KMEANS_FRAMEWORK_INTERNAL_COLUMNAR_HPP
+
+#include <interface.hpp>
+#include <exception.hpp>
+#include <mapped_file.hpp>
+#include <dataset.hpp>
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstddef>
+
+
+/*
+ * \brief Split "<x_file>,<y_file>" into the names of the column files.
+ */
+inline void split_column_files(const std::string &fileNames, std::string &xFile, std::string &yFile)
+{
+	std::size_t comma = fileNames.find(',');
+	if (comma == std::string::npos || fileNames.find(',', comma + 1) != std::string::npos)
+		throw (bpp::RuntimeError() << "Columnar input '" << fileNames << "' must be given as <x_file>,<y_file>.");
+	xFile = fileNames.substr(0, comma);
+	yFile = fileNames.substr(comma + 1);
+}
+
+
+/*
+ * \brief Load points whose coordinates are stored in separate files (raw arrays of coord_t, one per column).
+ *		Both columns are mapped (no intermediate copies) and interleaved into points concurrently.
+ * \param fileNames Column files in "<x_file>,<y_file>" form.
+ * \param res Vector where the points are stored.
+ */
+inline void load_split_columns(const std::string &fileNames, std::vector<point_t> &res)
+{
+	std::string xFile, yFile;
+	split_column_files(fileNames, xFile, yFile);
+
+	MappedFile x(xFile), y(yFile);
+	auto xs = x.view<point_t::coord_t>();
+	auto ys = y.view<point_t::coord_t>();
+	if (xs.size() != ys.size())
+		throw (bpp::RuntimeError() << "Column files '" << xFile << "' and '" << yFile << "' have different lengths ("
+			<< xs.size() << " and " << ys.size() << " values).");
+
+	res.resize(xs.size());
+	interleave_columns(dataset_header_t::INT64, xs.data(), ys.data(), res.size(), res.data());
+}
+
+
+/*
+ * \brief Save coordinates of the points into separate files (raw arrays of coord_t, one per column).
+ */
+inline void save_split_columns(const std::string &xFile, const std::string &yFile, array_view<const point_t> points)
+{
+	std::vector<point_t::coord_t> column(points.size());
+	for (std::size_t c = 0; c < 2; ++c) {
+		for (std::size_t i = 0; i < points.size(); ++i)
+			column[i] = (c == 0) ? points[i].x : points[i].y;
+
+		const std::string &fileName = (c == 0) ? xFile : yFile;
+		std::FILE *fp = std::fopen(fileName.c_str(), "wb");
+		if (fp == nullptr)
+			throw (bpp::RuntimeError() << "File '" << fileName << "' cannot be opened for writing.");
+		bool ok = std::fwrite(column.data(), sizeof(point_t::coord_t), column.size(), fp) == column.size();
+		std::fclose(fp);
+		if (!ok)
+			throw (bpp::RuntimeError() << "Error while writing data to file '" << fileName << "'.");
+	}
+}
+
+
+#endif
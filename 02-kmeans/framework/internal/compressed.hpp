@@ -0,0 +1,451 @@
+#ifndef KMEANS_FRAMEWORK_INTERNAL_COMPRESSED_HPP
+#define KMEANS_FRAMEWORK_INTERNAL_COMPRESSED_HPP
+
+#include <interface.hpp>
+#include <exception.hpp>
+#include <dataset.hpp>
+#include <workers.hpp>
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+
+
+/*
+ * \brief Header of the compressed point format (64 bytes, little-endian).
+ *		The header is followed by the block index ('blocks' + 1 file offsets, the last one
+ *		marks the end of data), by the checksums of the blocks and by the blocks. Each block holds
+ *		up to 'blockSize' points, its x and y coordinates are stored as separate columns of
+ *		offsets from the minimum of the column (frame of reference) in 0, 1, 2, 4 or 8 bytes.
+ *		Blocks are independent, so they may be decoded (and verified) in parallel.
+ */
+struct compressed_header_t
+{
+	static const std::uint32_t VERSION = 2;
+
+	char magic[8];				///< Always "KMPACKED".
+	std::uint32_t version;
+	std::uint32_t blockSize;	///< Maximal number of points in one block.
+	std::uint64_t count;		///< Total number of points.
+	std::uint64_t blocks;		///< Number of blocks.
+	std::uint64_t checksum;		///< Hash64 of the block index and of the block checksums.
+	std::uint8_t reserved[24];
+
+	compressed_header_t() : version(VERSION), blockSize(65536), count(0), blocks(0), checksum(0)
+	{
+		std::memcpy(magic, "KMPACKED", sizeof(magic));
+		std::memset(reserved, 0, sizeof(reserved));
+	}
+
+	static bool matches(const void *data, std::size_t size)
+	{
+		return size >= sizeof(compressed_header_t) && std::memcmp(data, "KMPACKED", 8) == 0;
+	}
+
+	/*
+	 * \brief Size of the block index and of the block checksums (the blocks have to be validated).
+	 */
+	std::size_t indexSize() const { return ((std::size_t)blocks + 1) * sizeof(std::uint64_t); }
+	std::size_t checksumsSize() const { return (std::size_t)blocks * sizeof(std::uint64_t); }
+
+	/*
+	 * \brief Offset of the first block in the file.
+	 */
+	std::size_t dataOffset() const { return sizeof(compressed_header_t) + indexSize() + checksumsSize(); }
+
+	void validate(const std::string &fileName, std::size_t fileSize) const
+	{
+		if (version != VERSION)
+			throw (bpp::RuntimeError() << "File '" << fileName << "' has unsupported format version " << version << ".");
+		if (blockSize == 0 || blocks != count / blockSize + (count % blockSize != 0))
+			throw (bpp::RuntimeError() << "File '" << fileName << "' has inconsistent block layout.");
+		if (fileSize < sizeof(compressed_header_t) + sizeof(std::uint64_t)
+			|| blocks > (fileSize - sizeof(compressed_header_t) - sizeof(std::uint64_t)) / (2 * sizeof(std::uint64_t)))
+			throw (bpp::RuntimeError() << "File '" << fileName << "' is truncated.");
+	}
+
+	/*
+	 * \brief Verify the checksum of the index and of the block checksums (stored contiguously after the header).
+	 */
+	void verifyIndex(const std::string &fileName, const void *index) const
+	{
+		Hash64 hash;
+		hash.update(index, indexSize() + checksumsSize());
+		if (hash.digest() != checksum)
+			throw (bpp::RuntimeError() << "File '" << fileName << "' is corrupted (checksum mismatch of the block index).");
+	}
+
+	/*
+	 * \brief Verify the block index (the offsets must be increasing and stay within the file).
+	 */
+	void verifyOffsets(const std::string &fileName, const std::uint64_t *index, std::size_t fileSize) const
+	{
+		if (index[0] != dataOffset() || index[blocks] > fileSize)
+			throw (bpp::RuntimeError() << "File '" << fileName << "' has corrupted block index.");
+		for (std::size_t i = 0; i < blocks; ++i) {
+			if (index[i] > index[i + 1])
+				throw (bpp::RuntimeError() << "File '" << fileName << "' has corrupted block index.");
+		}
+	}
+};
+
+static_assert(sizeof(compressed_header_t) == 64, "The compressed header must have exactly 64 bytes.");
+
+
+/*
+ * \brief Encoding and decoding of the individual blocks.
+ */
+class PackedBlock
+{
+private:
+	/*
+	 * \brief Description of one coordinate column (stored at the beginning of the column).
+	 */
+	struct column_t
+	{
+		std::int64_t base;		///< Minimum of the column.
+		std::uint8_t bytes;		///< Width of one stored offset (0, 1, 2, 4 or 8).
+		std::uint8_t padding[7];
+	};
+
+	/*
+	 * \brief Smallest supported width (in bytes) of an offset from the base.
+	 */
+	static std::uint8_t width(std::uint64_t range)
+	{
+		if (range == 0) return 0;
+		if (range <= 0xff) return 1;
+		if (range <= 0xffff) return 2;
+		if (range <= 0xffffffff) return 4;
+		return 8;
+	}
+
+	template<typename T, typename GET>
+	static void storeOffsets(std::size_t count, GET get, std::uint64_t base, unsigned char *data)
+	{
+		for (std::size_t i = 0; i < count; ++i) {
+			T offset = (T)((std::uint64_t)get(i) - base);
+			std::memcpy(data + i * sizeof(T), &offset, sizeof(T));
+		}
+	}
+
+	template<typename T>
+	static void loadOffsets(const unsigned char *data, std::size_t count, std::uint64_t base, point_t *res, point_t::coord_t point_t::*coord)
+	{
+		for (std::size_t i = 0; i < count; ++i) {
+			T offset;
+			std::memcpy(&offset, data + i * sizeof(T), sizeof(T));
+			res[i].*coord = (point_t::coord_t)(base + offset);
+		}
+	}
+
+	template<typename GET>
+	static void encodeColumn(std::size_t count, GET get, std::vector<unsigned char> &out)
+	{
+		std::int64_t minimum = get(0), maximum = minimum;
+		for (std::size_t i = 1; i < count; ++i) {
+			minimum = std::min<std::int64_t>(minimum, get(i));
+			maximum = std::max<std::int64_t>(maximum, get(i));
+		}
+
+		column_t column;
+		std::memset(&column, 0, sizeof(column));
+		column.base = minimum;
+		column.bytes = width((std::uint64_t)maximum - (std::uint64_t)minimum);
+
+		std::size_t offset = out.size();
+		out.resize(offset + sizeof(column) + count * column.bytes);
+		std::memcpy(&out[offset], &column, sizeof(column));
+
+		unsigned char *data = &out[offset + sizeof(column)];
+		std::uint64_t base = (std::uint64_t)minimum;
+		switch (column.bytes) {
+		case 1: storeOffsets<std::uint8_t>(count, get, base, data); break;
+		case 2: storeOffsets<std::uint16_t>(count, get, base, data); break;
+		case 4: storeOffsets<std::uint32_t>(count, get, base, data); break;
+		case 8: storeOffsets<std::uint64_t>(count, get, base, data); break;
+		}
+	}
+
+	/*
+	 * \brief Decode one column into x or y coordinates of the points, return the size of the column.
+	 */
+	static std::size_t decodeColumn(const unsigned char *data, std::size_t size, std::size_t count,
+		point_t *res, point_t::coord_t point_t::*coord)
+	{
+		column_t column;
+		if (size < sizeof(column))
+			throw bpp::RuntimeError("Compressed block is truncated.");
+		std::memcpy(&column, data, sizeof(column));
+		if (column.bytes > 8 || (column.bytes & (column.bytes - 1)) != 0 || size - sizeof(column) < count * column.bytes)
+			throw bpp::RuntimeError("Compressed block is corrupted.");
+		data += sizeof(column);
+
+		std::uint64_t base = (std::uint64_t)column.base;
+		switch (column.bytes) {
+		case 0:
+			for (std::size_t i = 0; i < count; ++i)
+				res[i].*coord = (point_t::coord_t)base;
+			break;
+		case 1: loadOffsets<std::uint8_t>(data, count, base, res, coord); break;
+		case 2: loadOffsets<std::uint16_t>(data, count, base, res, coord); break;
+		case 4: loadOffsets<std::uint32_t>(data, count, base, res, coord); break;
+		case 8: loadOffsets<std::uint64_t>(data, count, base, res, coord); break;
+		}
+		return sizeof(column) + count * column.bytes;
+	}
+
+public:
+	/*
+	 * \brief Append encoded block of points to the output buffer.
+	 */
+	static void encode(const point_t *points, std::size_t count, std::vector<unsigned char> &out)
+	{
+		encodeColumn(count, [points](std::size_t i) { return (std::int64_t)points[i].x; }, out);
+		encodeColumn(count, [points](std::size_t i) { return (std::int64_t)points[i].y; }, out);
+	}
+
+	/*
+	 * \brief Verify the checksum of a block and decode its 'count' points.
+	 */
+	static void decode(const unsigned char *data, std::size_t size, std::uint64_t checksum, std::size_t count, point_t *res)
+	{
+		Hash64 hash;
+		hash.update(data, size);
+		if (hash.digest() != checksum)
+			throw bpp::RuntimeError("Compressed block is corrupted (checksum mismatch).");
+
+		std::size_t used = decodeColumn(data, size, count, res, &point_t::x);
+		decodeColumn(data + used, size - used, count, res, &point_t::y);
+	}
+};
+
+
+/*
+ * \brief Check whether a file is in the compressed point format.
+ */
+inline bool is_compressed_file(const std::string &fileName)
+{
+	std::FILE *fp = std::fopen(fileName.c_str(), "rb");
+	if (fp == nullptr)
+		return false;
+	compressed_header_t header;
+	bool res = std::fread(&header, sizeof(header), 1, fp) == 1 && compressed_header_t::matches(&header, sizeof(header));
+	std::fclose(fp);
+	return res;
+}
+
+
+/*
+ * \brief Number of points in compressed data already in memory (only the header is validated).
+ */
+inline std::size_t compressed_point_count(const std::string &fileName, const void *data, std::size_t size)
+{
+	compressed_header_t header;
+	if (!compressed_header_t::matches(data, size))
+		throw (bpp::RuntimeError() << "File '" << fileName << "' is not in the compressed format.");
+	std::memcpy(&header, data, sizeof(header));
+	header.validate(fileName, size);
+	return (std::size_t)header.count;
+}
+
+
+/*
+ * \brief Decode an entire compressed file (already in memory) into a vector of points.
+ *		The blocks are verified and decoded concurrently.
+ */
+inline void decode_compressed(const std::string &fileName, const void *data, std::size_t size, std::vector<point_t> &res)
+{
+	compressed_header_t header;
+	if (!compressed_header_t::matches(data, size))
+		throw (bpp::RuntimeError() << "File '" << fileName << "' is not in the compressed format.");
+	std::memcpy(&header, data, sizeof(header));
+	header.validate(fileName, size);
+
+	const unsigned char *bytes = (const unsigned char*)data;
+	header.verifyIndex(fileName, bytes + sizeof(header));
+
+	std::vector<std::uint64_t> index((std::size_t)header.blocks + 1), checksums((std::size_t)header.blocks);
+	std::memcpy(index.data(), bytes + sizeof(header), header.indexSize());
+	std::memcpy(checksums.data(), bytes + sizeof(header) + header.indexSize(), header.checksumsSize());
+	header.verifyOffsets(fileName, index.data(), size);
+
+	res.resize((std::size_t)header.count);
+	try {
+		run_tasks((std::size_t)header.blocks, [&](std::size_t block) {
+			std::size_t first = block * header.blockSize;
+			std::size_t count = std::min<std::size_t>(header.blockSize, res.size() - first);
+			PackedBlock::decode(bytes + index[block], (std::size_t)(index[block + 1] - index[block]), checksums[block], count, &res[first]);
+		});
+	}
+	catch (std::exception &e) {
+		throw (bpp::RuntimeError() << "File '" << fileName << "': " << e.what());
+	}
+}
+
+
+/*
+ * \brief Save points in the compressed format.
+ */
+inline void save_compressed(const std::string &fileName, array_view<const point_t> points, std::uint32_t blockSize = 65536)
+{
+	compressed_header_t header;
+	header.blockSize = blockSize;
+	header.count = points.size();
+	header.blocks = (points.size() + blockSize - 1) / blockSize;
+
+	std::vector<std::uint64_t> index, checksums;
+	std::vector<unsigned char> blocks;
+	for (std::size_t first = 0; first < points.size(); first += blockSize) {
+		index.push_back(blocks.size());
+		PackedBlock::encode(&points[first], std::min<std::size_t>(blockSize, points.size() - first), blocks);
+
+		Hash64 hash;
+		hash.update(&blocks[index.back()], blocks.size() - index.back());
+		checksums.push_back(hash.digest());
+	}
+	index.push_back(blocks.size());
+
+	for (auto &offset : index)
+		offset += header.dataOffset();
+
+	Hash64 hash;
+	hash.update(index.data(), index.size() * sizeof(std::uint64_t));
+	hash.update(checksums.data(), checksums.size() * sizeof(std::uint64_t));
+	header.checksum = hash.digest();
+
+	std::FILE *fp = std::fopen(fileName.c_str(), "wb");
+	if (fp == nullptr)
+		throw (bpp::RuntimeError() << "File '" << fileName << "' cannot be opened for writing.");
+	bool ok = std::fwrite(&header, sizeof(header), 1, fp) == 1
+		&& std::fwrite(index.data(), sizeof(std::uint64_t), index.size(), fp) == index.size()
+		&& std::fwrite(checksums.data(), sizeof(std::uint64_t), checksums.size(), fp) == checksums.size()
+		&& std::fwrite(blocks.data(), 1, blocks.size(), fp) == blocks.size();
+	std::fclose(fp);
+	if (!ok)
+		throw (bpp::RuntimeError() << "Error while writing data to file '" << fileName << "'.");
+}
+
+
+/*
+ * \brief Sequential decoder of a compressed file that yields the points in batches,
+ *		so the compressed data can feed a streaming engine directly. Every block is verified
+ *		by its checksum when it is decoded.
+ */
+class CompressedStream
+{
+private:
+	std::FILE *mFile;
+	std::string mFileName;
+	compressed_header_t mHeader;
+	std::vector<std::uint64_t> mIndex;
+	std::vector<std::uint64_t> mChecksums;
+	std::size_t mBlock;					///< Next block to be decoded.
+	std::vector<unsigned char> mPacked;
+	std::vector<point_t> mDecoded;		///< Decoded block which was not entirely consumed yet.
+	std::size_t mDecodedPos;
+
+	std::size_t blockCount(std::size_t block) const
+	{
+		return std::min<std::size_t>(mHeader.blockSize, (std::size_t)mHeader.count - block * mHeader.blockSize);
+	}
+
+	void decodeNext(point_t *res)
+	{
+		mPacked.resize((std::size_t)(mIndex[mBlock + 1] - mIndex[mBlock]));
+		if (std::fread(mPacked.data(), 1, mPacked.size(), mFile) != mPacked.size())
+			throw (bpp::RuntimeError() << "Error while reading from file '" << mFileName << "'.");
+		try {
+			PackedBlock::decode(mPacked.data(), mPacked.size(), mChecksums[mBlock], blockCount(mBlock), res);
+		}
+		catch (std::exception &e) {
+			throw (bpp::RuntimeError() << "File '" << mFileName << "': " << e.what());
+		}
+		++mBlock;
+	}
+
+public:
+	CompressedStream(const std::string &fileName) : mFileName(fileName)
+	{
+		mFile = std::fopen(fileName.c_str(), "rb");
+		if (mFile == nullptr)
+			throw (bpp::RuntimeError() << "File '" << fileName << "' cannot be opened for reading.");
+
+		try {
+			std::fseek(mFile, 0, SEEK_END);
+			std::size_t fileSize = (std::size_t)std::ftell(mFile);
+			std::fseek(mFile, 0, SEEK_SET);
+			if (std::fread(&mHeader, sizeof(mHeader), 1, mFile) != 1 || !compressed_header_t::matches(&mHeader, sizeof(mHeader)))
+				throw (bpp::RuntimeError() << "File '" << fileName << "' is not in the compressed format.");
+			mHeader.validate(fileName, fileSize);
+
+			// The index and the checksums are stored contiguously, so they are read and verified together.
+			std::vector<std::uint64_t> index((std::size_t)mHeader.blocks * 2 + 1);
+			if (std::fread(index.data(), sizeof(std::uint64_t), index.size(), mFile) != index.size())
+				throw (bpp::RuntimeError() << "Error while reading from file '" << fileName << "'.");
+			mHeader.verifyIndex(fileName, index.data());
+			mIndex.assign(index.begin(), index.begin() + mHeader.blocks + 1);
+			mChecksums.assign(index.begin() + mHeader.blocks + 1, index.end());
+			mHeader.verifyOffsets(fileName, mIndex.data(), fileSize);
+		}
+		catch (...) {
+			std::fclose(mFile);
+			throw;
+		}
+		rewind();
+	}
+
+	CompressedStream(const CompressedStream&) = delete;
+	CompressedStream& operator=(const CompressedStream&) = delete;
+
+	~CompressedStream()
+	{
+		std::fclose(mFile);
+	}
+
+	std::size_t count() const { return (std::size_t)mHeader.count; }
+
+	void rewind()
+	{
+		std::fseek(mFile, (long)mIndex[0], SEEK_SET);
+		mBlock = 0;
+		mDecoded.clear();
+		mDecodedPos = 0;
+	}
+
+	/*
+	 * \brief Decode up to 'size' next points, return how many were actually decoded.
+	 */
+	std::size_t read(point_t *res, std::size_t size)
+	{
+		std::size_t done = 0;
+		while (done < size) {
+			if (mDecodedPos < mDecoded.size()) {
+				std::size_t batch = std::min(size - done, mDecoded.size() - mDecodedPos);
+				std::copy(mDecoded.begin() + mDecodedPos, mDecoded.begin() + mDecodedPos + batch, res + done);
+				mDecodedPos += batch;
+				done += batch;
+			}
+			else if (mBlock >= mHeader.blocks)
+				break;
+			else if (size - done >= blockCount(mBlock)) {
+				std::size_t count = blockCount(mBlock);
+				decodeNext(res + done);		// Whole block fits, decode it in place.
+				done += count;
+			}
+			else {
+				mDecoded.resize(blockCount(mBlock));
+				decodeNext(mDecoded.data());
+				mDecodedPos = 0;
+			}
+		}
+		return done;
+	}
+};
+
+
+#endif
@@ -0,0 +1,520 @@
+#ifndef KMEANS_FRAMEWORK_INTERNAL_DATASET_HPP
+#define KMEANS_FRAMEWORK_INTERNAL_DATASET_HPP
+
+#include <interface.hpp>
+#include <exception.hpp>
+#include <workers.hpp>
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+
+
+/*
+ * \brief Streaming 64-bit hash of a byte sequence (the XXH64 algorithm, seed 0).
+ */
+class Hash64
+{
+private:
+	static const std::uint64_t P1 = 11400714785074694791ULL;
+	static const std::uint64_t P2 = 14029467366897019727ULL;
+	static const std::uint64_t P3 = 1609587929392839161ULL;
+	static const std::uint64_t P4 = 9650029242287828579ULL;
+	static const std::uint64_t P5 = 2870177450012600261ULL;
+
+	std::uint64_t mAcc[4];
+	std::uint64_t mLength;
+	unsigned char mBuffer[32];
+	std::size_t mBuffered;
+
+	static std::uint64_t rotl(std::uint64_t x, int r)
+	{
+		return (x << r) | (x >> (64 - r));
+	}
+
+	static std::uint64_t read64(const unsigned char *data)
+	{
+		std::uint64_t res;
+		std::memcpy(&res, data, sizeof(res));
+		return res;
+	}
+
+	static std::uint64_t round(std::uint64_t acc, std::uint64_t input)
+	{
+		return rotl(acc + input * P2, 31) * P1;
+	}
+
+	static std::uint64_t merge(std::uint64_t acc, std::uint64_t val)
+	{
+		return (acc ^ round(0, val)) * P1 + P4;
+	}
+
+	void stripe(const unsigned char *data)
+	{
+		for (std::size_t i = 0; i < 4; ++i)
+			mAcc[i] = round(mAcc[i], read64(data + i*8));
+	}
+
+public:
+	Hash64() : mLength(0), mBuffered(0)
+	{
+		mAcc[0] = P1 + P2;
+		mAcc[1] = P2;
+		mAcc[2] = 0;
+		mAcc[3] = 0 - P1;
+	}
+
+	void update(const void *data, std::size_t size)
+	{
+		const unsigned char *bytes = (const unsigned char*)data;
+		mLength += size;
+
+		if (mBuffered > 0) {
+			std::size_t fill = std::min(size, 32 - mBuffered);
+			std::memcpy(mBuffer + mBuffered, bytes, fill);
+			mBuffered += fill;
+			bytes += fill;
+			size -= fill;
+			if (mBuffered < 32) return;
+			stripe(mBuffer);
+			mBuffered = 0;
+		}
+
+		for (; size >= 32; bytes += 32, size -= 32)
+			stripe(bytes);
+
+		std::memcpy(mBuffer, bytes, size);
+		mBuffered = size;
+	}
+
+	std::uint64_t digest() const
+	{
+		std::uint64_t h;
+		if (mLength >= 32) {
+			h = rotl(mAcc[0], 1) + rotl(mAcc[1], 7) + rotl(mAcc[2], 12) + rotl(mAcc[3], 18);
+			for (std::size_t i = 0; i < 4; ++i)
+				h = merge(h, mAcc[i]);
+		}
+		else
+			h = P5;
+		h += mLength;
+
+		const unsigned char *p = mBuffer, *end = mBuffer + mBuffered;
+		for (; p + 8 <= end; p += 8)
+			h = rotl(h ^ round(0, read64(p)), 27) * P1 + P4;
+		if (p + 4 <= end) {
+			std::uint32_t k;
+			std::memcpy(&k, p, sizeof(k));
+			h = rotl(h ^ ((std::uint64_t)k * P1), 23) * P2 + P3;
+			p += 4;
+		}
+		for (; p < end; ++p)
+			h = rotl(h ^ (*p * P5), 11) * P1;
+
+		h ^= h >> 33;
+		h *= P2;
+		h ^= h >> 29;
+		h *= P3;
+		h ^= h >> 32;
+		return h;
+	}
+};
+
+
+/*
+ * \brief Header of the self-describing dataset format (64 bytes, little-endian).
+ *		The header is followed by 'count' records of 'dimension' coordinates and then
+ *		(if FLAG_WEIGHTS is set) by 'count' weights stored as doubles. With FLAG_COLUMNAR,
+ *		the coordinates are stored column by column instead (all x, then all y).
+ *		Files without the header are raw arrays of point_t records.
+ */
+struct dataset_header_t
+{
+	enum coord_type_t : std::uint32_t { INT32 = 1, INT64 = 2, FLOAT = 3, DOUBLE = 4 };
+
+	static const std::uint32_t VERSION = 1;
+	static const std::uint32_t FLAG_WEIGHTS = 1;	///< Per-point weights follow the coordinates.
+	static const std::uint32_t FLAG_COLUMNAR = 2;	///< Coordinates are stored in columns, not in records.
+
+	char magic[8];				///< Always "KMPOINTS".
+	std::uint32_t version;
+	std::uint32_t coordType;	///< One of coord_type_t values.
+	std::uint32_t dimension;	///< Number of coordinates of each point.
+	std::uint32_t flags;
+	std::uint64_t count;		///< Number of points.
+	std::uint64_t checksum;		///< Hash64 of all bytes following the header.
+	std::uint8_t reserved[24];
+
+	dataset_header_t() : version(VERSION), coordType(INT64), dimension(2), flags(0), count(0), checksum(0)
+	{
+		std::memcpy(magic, "KMPOINTS", sizeof(magic));
+		std::memset(reserved, 0, sizeof(reserved));
+	}
+
+	static std::size_t coordSize(std::uint32_t type)
+	{
+		switch (type) {
+		case INT32: case FLOAT: return 4;
+		case INT64: case DOUBLE: return 8;
+		default: return 0;
+		}
+	}
+
+	/*
+	 * \brief Check the magic value (used for detection of headered files).
+	 */
+	static bool matches(const void *data, std::size_t size)
+	{
+		return size >= sizeof(dataset_header_t) && std::memcmp(data, "KMPOINTS", 8) == 0;
+	}
+
+	std::size_t recordSize() const { return coordSize(coordType) * dimension; }
+
+	/*
+	 * \brief Number of payload bytes per point (the record and the optional weight).
+	 */
+	std::size_t pointSize() const { return recordSize() + ((flags & FLAG_WEIGHTS) ? sizeof(double) : 0); }
+
+	/*
+	 * \note The count has to be validated first, otherwise the product may overflow.
+	 */
+	std::size_t payloadSize() const
+	{
+		return (std::size_t)count * pointSize();
+	}
+
+	/*
+	 * \brief Verify the header is consistent and describes data the point_t engines can process.
+	 */
+	void validate(const std::string &fileName, std::size_t fileSize) const
+	{
+		if (version != VERSION)
+			throw (bpp::RuntimeError() << "File '" << fileName << "' has unsupported format version " << version << ".");
+		if (coordSize(coordType) == 0)
+			throw (bpp::RuntimeError() << "File '" << fileName << "' has unknown coordinate type " << coordType << ".");
+		if (coordType == FLOAT || coordType == DOUBLE)
+			throw (bpp::RuntimeError() << "File '" << fileName << "' has floating-point coordinates, which the integer kernels cannot process.");
+		if (dimension != 2)
+			throw (bpp::RuntimeError() << "File '" << fileName << "' has " << dimension << " dimensions, only 2 are supported.");
+		if (flags & FLAG_WEIGHTS)
+			throw (bpp::RuntimeError() << "File '" << fileName << "' holds weighted points, which are not supported.");
+		if (flags & ~FLAG_COLUMNAR)
+			throw (bpp::RuntimeError() << "File '" << fileName << "' has unknown flags " << flags << ".");
+		if (fileSize < sizeof(dataset_header_t) || count > (fileSize - sizeof(dataset_header_t)) / pointSize())
+			throw (bpp::RuntimeError() << "File '" << fileName << "' is truncated.");
+	}
+
+	/*
+	 * \brief Whether the payload is already an array of point_t (so it may be used without conversion).
+	 */
+	bool native() const
+	{
+		return coordType == INT64 && dimension == 2 && flags == 0;
+	}
+
+	bool columnar() const { return (flags & FLAG_COLUMNAR) != 0; }
+};
+
+static_assert(sizeof(dataset_header_t) == 64, "The dataset header must have exactly 64 bytes.");
+
+
+/*
+ * \brief Convert a batch of stored records into points (the header has to be validated).
+ */
+inline void convert_records(const dataset_header_t &header, const void *data, std::size_t count, point_t *res)
+{
+	if (header.coordType == dataset_header_t::INT64) {
+		std::memcpy(res, data, count * sizeof(point_t));
+		return;
+	}
+
+	const std::int32_t *coords = (const std::int32_t*)data;
+	for (std::size_t i = 0; i < count; ++i) {
+		res[i].x = coords[2*i];
+		res[i].y = coords[2*i + 1];
+	}
+}
+
+
+/*
+ * \brief Store a batch of coordinates of one column (0 = x, 1 = y) into points.
+ */
+inline void convert_column(std::uint32_t coordType, const void *data, std::size_t count, std::size_t column, point_t *res)
+{
+	point_t::coord_t point_t::*coord = (column == 0) ? &point_t::x : &point_t::y;
+	if (coordType == dataset_header_t::INT64) {
+		const std::int64_t *coords = (const std::int64_t*)data;
+		for (std::size_t i = 0; i < count; ++i)
+			res[i].*coord = coords[i];
+	}
+	else {
+		const std::int32_t *coords = (const std::int32_t*)data;
+		for (std::size_t i = 0; i < count; ++i)
+			res[i].*coord = coords[i];
+	}
+}
+
+
+/*
+ * \brief Interleave coordinate columns into points. Ranges of points are filled concurrently,
+ *		so the (mapped) columns are read in parallel and each point is written only once.
+ */
+inline void interleave_columns(std::uint32_t coordType, const void *x, const void *y, std::size_t count, point_t *res)
+{
+	const std::size_t rangeSize = 1024*1024;
+	const std::size_t coordSize = dataset_header_t::coordSize(coordType);
+	run_tasks((count + rangeSize - 1) / rangeSize, [&](std::size_t range) {
+		std::size_t offset = range * rangeSize;
+		std::size_t size = std::min(rangeSize, count - offset);
+		convert_column(coordType, (const char*)x + offset * coordSize, size, 0, res + offset);
+		convert_column(coordType, (const char*)y + offset * coordSize, size, 1, res + offset);
+	});
+}
+
+
+/*
+ * \brief Check whether a file starts with the dataset header (otherwise it is a raw point_t array).
+ */
+inline bool is_dataset_file(const std::string &fileName)
+{
+	std::FILE *fp = std::fopen(fileName.c_str(), "rb");
+	if (fp == nullptr)
+		return false;
+	dataset_header_t header;
+	bool res = std::fread(&header, sizeof(header), 1, fp) == 1 && dataset_header_t::matches(&header, sizeof(header));
+	std::fclose(fp);
+	return res;
+}
+
+
+/*
+ * \brief Read the payload of a dataset (its header has been already read and validated)
+ *		from the current position of the file batch by batch, verifying its checksum.
+ *		The file is read strictly sequentially, so it may also be a pipe.
+ * \param place Functor (std::size_t offset, std::size_t count) which returns where the points
+ *		offset .. offset+count-1 are stored. It is invoked only after their data have been read.
+ */
+template<typename PLACE>
+void read_dataset_batches(std::FILE *fp, const std::string &fileName, const dataset_header_t &header, PLACE place)
+{
+	std::vector<char> buffer;
+	Hash64 hash;
+
+	// Columnar files are read column by column, each batch fills one coordinate of the points.
+	std::size_t count = (std::size_t)header.count;
+	std::size_t columns = header.columnar() ? header.dimension : 1;
+	std::size_t batchRecordSize = header.recordSize() / columns;
+	for (std::size_t column = 0; column < columns; ++column) {
+		std::size_t offset = 0;
+		while (offset < count) {
+			std::size_t batch = std::min<std::size_t>(count - offset, 1024*1024);
+			buffer.resize(batch * batchRecordSize);
+			if (std::fread(buffer.data(), 1, buffer.size(), fp) != buffer.size())
+				throw (bpp::RuntimeError() << "Error while reading from file '" << fileName << "'.");
+			hash.update(buffer.data(), buffer.size());
+			if (header.columnar())
+				convert_column(header.coordType, buffer.data(), batch, column, place(offset, batch));
+			else
+				convert_records(header, buffer.data(), batch, place(offset, batch));
+			offset += batch;
+		}
+	}
+
+	if (hash.digest() != header.checksum)
+		throw (bpp::RuntimeError() << "File '" << fileName << "' is corrupted (checksum mismatch).");
+}
+
+
+/*
+ * \brief Read the payload of a dataset into a prepared place (see read_dataset_batches).
+ * \param res Where the points are stored (header.count of them).
+ */
+inline void read_dataset_payload(std::FILE *fp, const std::string &fileName, const dataset_header_t &header,
+	array_view<point_t> res)
+{
+	read_dataset_batches(fp, fileName, header, [&](std::size_t offset, std::size_t) { return &res[offset]; });
+}
+
+
+/*
+ * \brief Read and validate the header of a dataset file opened for reading.
+ */
+inline dataset_header_t read_dataset_header(std::FILE *fp, const std::string &fileName)
+{
+	std::fseek(fp, 0, SEEK_END);
+	std::size_t fileSize = (std::size_t)std::ftell(fp);
+	std::fseek(fp, 0, SEEK_SET);
+
+	dataset_header_t header;
+	if (std::fread(&header, sizeof(header), 1, fp) != 1 || !dataset_header_t::matches(&header, sizeof(header)))
+		throw (bpp::RuntimeError() << "File '" << fileName << "' does not contain a dataset header.");
+	header.validate(fileName, fileSize);
+	return header;
+}
+
+
+/*
+ * \brief Load a headered dataset file, verifying its checksum.
+ * \param prepare Functor (std::size_t count) which returns the place for the points.
+ */
+template<typename PREPARE>
+void load_dataset(const std::string &fileName, PREPARE prepare)
+{
+	std::FILE *fp = std::fopen(fileName.c_str(), "rb");
+	if (fp == nullptr)
+		throw (bpp::RuntimeError() << "File '" << fileName << "' cannot be opened for reading.");
+
+	try {
+		dataset_header_t header = read_dataset_header(fp, fileName);
+		read_dataset_payload(fp, fileName, header, prepare((std::size_t)header.count));
+	}
+	catch (...) {
+		std::fclose(fp);
+		throw;
+	}
+
+	std::fclose(fp);
+}
+
+
+/*
+ * \brief Load a headered dataset file into a vector of points, verifying its checksum.
+ */
+inline void load_dataset(const std::string &fileName, std::vector<point_t> &res)
+{
+	load_dataset(fileName, [&](std::size_t count) {
+		res.resize(count);
+		return array_view<point_t>(res);
+	});
+}
+
+
+/*
+ * \brief Load a headered dataset file into a prepared place (its size must match the file), verifying its checksum.
+ */
+inline void load_dataset(const std::string &fileName, array_view<point_t> res)
+{
+	load_dataset(fileName, [&](std::size_t count) {
+		if (count != res.size())
+			throw (bpp::RuntimeError() << "File '" << fileName << "' has changed while being loaded.");
+		return res;
+	});
+}
+
+
+/*
+ * \brief Read and validate the header of a dataset file (the payload is not read).
+ */
+inline dataset_header_t read_dataset_header(const std::string &fileName)
+{
+	std::FILE *fp = std::fopen(fileName.c_str(), "rb");
+	if (fp == nullptr)
+		throw (bpp::RuntimeError() << "File '" << fileName << "' cannot be opened for reading.");
+
+	dataset_header_t header;
+	try {
+		header = read_dataset_header(fp, fileName);
+	}
+	catch (...) {
+		std::fclose(fp);
+		throw;
+	}
+
+	std::fclose(fp);
+	return header;
+}
+
+
+/*
+ * \brief Interpret file contents already in memory (e.g., mapped) as points. Raw files and
+ *		headered files with native records are used in place, other ones are converted.
+ * \param fileName Name of the file (for error messages).
+ * \param data Contents of the entire file.
+ * \param size Size of the file in bytes.
+ * \param storage Vector where converted points are stored if necessary.
+ */
+inline array_view<const point_t> dataset_points(const std::string &fileName, const void *data, std::size_t size,
+	std::vector<point_t> &storage)
+{
+	if (!dataset_header_t::matches(data, size))
+		return array_view<const point_t>((const point_t*)data, size / sizeof(point_t));
+
+	dataset_header_t header;
+	std::memcpy(&header, data, sizeof(header));
+	header.validate(fileName, size);
+
+	const char *payload = (const char*)data + sizeof(header);
+	Hash64 hash;
+	hash.update(payload, header.payloadSize());
+	if (hash.digest() != header.checksum)
+		throw (bpp::RuntimeError() << "File '" << fileName << "' is corrupted (checksum mismatch).");
+
+	if (header.native())
+		return array_view<const point_t>((const point_t*)payload, (std::size_t)header.count);
+
+	storage.resize((std::size_t)header.count);
+	if (header.columnar())
+		interleave_columns(header.coordType, payload, payload + storage.size() * header.coordSize(header.coordType),
+			storage.size(), storage.data());
+	else
+		convert_records(header, payload, storage.size(), storage.data());
+	return storage;
+}
+
+
+/*
+ * \brief Save points as a headered dataset file with the given coordinate type (INT32 or INT64).
+ * \param columnar Whether the coordinates are stored in columns (FLAG_COLUMNAR) instead of records.
+ */
+inline void save_dataset(const std::string &fileName, array_view<const point_t> points, std::uint32_t coordType,
+	bool columnar = false)
+{
+	dataset_header_t header;
+	header.coordType = coordType;
+	header.count = points.size();
+	header.flags = columnar ? dataset_header_t::FLAG_COLUMNAR : 0;
+
+	// Position of coordinate c of point i in the payload.
+	std::size_t n = points.size();
+	auto index = [&](std::size_t i, std::size_t c) { return columnar ? c*n + i : 2*i + c; };
+
+	std::vector<char> payload(header.payloadSize());
+	if (coordType == dataset_header_t::INT64) {
+		std::int64_t *coords = (std::int64_t*)payload.data();
+		for (std::size_t i = 0; i < n; ++i) {
+			coords[index(i, 0)] = points[i].x;
+			coords[index(i, 1)] = points[i].y;
+		}
+	}
+	else if (coordType == dataset_header_t::INT32) {
+		std::int32_t *coords = (std::int32_t*)payload.data();
+		for (std::size_t i = 0; i < n; ++i) {
+			if (points[i].x != (std::int32_t)points[i].x || points[i].y != (std::int32_t)points[i].y)
+				throw (bpp::RuntimeError() << "Point " << i << " does not fit into 32-bit coordinates.");
+			coords[index(i, 0)] = (std::int32_t)points[i].x;
+			coords[index(i, 1)] = (std::int32_t)points[i].y;
+		}
+	}
+	else
+		throw (bpp::RuntimeError() << "Coordinate type " << coordType << " cannot be produced from integer points.");
+
+	Hash64 hash;
+	hash.update(payload.data(), payload.size());
+	header.checksum = hash.digest();
+
+	std::FILE *fp = std::fopen(fileName.c_str(), "wb");
+	if (fp == nullptr)
+		throw (bpp::RuntimeError() << "File '" << fileName << "' cannot be opened for writing.");
+	bool ok = std::fwrite(&header, sizeof(header), 1, fp) == 1
+		&& std::fwrite(payload.data(), 1, payload.size(), fp) == payload.size();
+	std::fclose(fp);
+	if (!ok)
+		throw (bpp::RuntimeError() << "Error while writing data to file '" << fileName << "'.");
+}
+
+
+#endif
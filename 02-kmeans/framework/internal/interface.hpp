@@ -1,9 +1,17 @@
 #ifndef KMEANS_FRAMEWORK_INTERNAL_INTERFACE_HPP
 #define KMEANS_FRAMEWORK_INTERNAL_INTERFACE_HPP
 
+#include <timers.hpp>
+#include <task_trace.hpp>
+#include <work_stats.hpp>
+
 #include <vector>
 #include <utility>
+#include <limits>
+#include <algorithm>
+#include <ostream>
 #include <cstdint>
+#include <cstddef>
 
 
 /*
@@ -17,6 +25,189 @@ struct point_t
 
 
 
+/*
+ * \brief Quality statistics of one cluster (size, sum of squared distances of its points
+ *		to the centroid and bounding box of its points). The squared distances are summed
+ *		exactly as a 128-bit integer, so the result does not depend on the summation order.
+ */
+struct cluster_stats_t
+{
+	std::uint64_t count;
+	std::uint64_t sseLow, sseHigh;	///< Low and high half of the sum of squared distances.
+	point_t::coord_t minX, minY, maxX, maxY;
+
+	cluster_stats_t() { clear(); }
+
+	void clear()
+	{
+		count = sseLow = sseHigh = 0;
+		minX = minY = std::numeric_limits<point_t::coord_t>::max();
+		maxX = maxY = std::numeric_limits<point_t::coord_t>::min();
+	}
+
+	void addSquaredDistance(std::uint64_t low, std::uint64_t high)
+	{
+		sseLow += low;
+		sseHigh += high + (sseLow < low ? 1 : 0);
+	}
+
+	template<typename POINT>
+	void add(const POINT &point, std::uint64_t squaredDistance)
+	{
+		++count;
+		addSquaredDistance(squaredDistance, 0);
+		minX = std::min<point_t::coord_t>(minX, point.x);
+		minY = std::min<point_t::coord_t>(minY, point.y);
+		maxX = std::max<point_t::coord_t>(maxX, point.x);
+		maxY = std::max<point_t::coord_t>(maxY, point.y);
+	}
+
+	void merge(const cluster_stats_t &stats)
+	{
+		count += stats.count;
+		addSquaredDistance(stats.sseLow, stats.sseHigh);
+		minX = std::min(minX, stats.minX);
+		minY = std::min(minY, stats.minY);
+		maxX = std::max(maxX, stats.maxX);
+		maxY = std::max(maxY, stats.maxY);
+	}
+
+	double sse() const
+	{
+		return (double)sseHigh * 18446744073709551616.0 + (double)sseLow;
+	}
+};
+
+
+
+/*
+ * \brief Whether the assignment work counters are compiled in (define KMEANS_WORK_COUNTERS to enable them).
+ */
+#ifdef KMEANS_WORK_COUNTERS
+constexpr bool WORK_COUNTERS = true;
+#else
+constexpr bool WORK_COUNTERS = false;
+#endif
+
+
+/*
+ * \brief Work of the assignment step of one iteration. All assignment strategies report the same
+ *		counters, so their effectiveness can be compared with the naive n*k distance evaluations.
+ */
+struct assignment_counters_t
+{
+	std::uint64_t distances = 0;	///< Evaluated point-centroid distances.
+	std::uint64_t pruned = 0;		///< Candidate centroids excluded by bounds (without evaluating their distances).
+	std::uint64_t skipped = 0;		///< Points which kept their cluster without examining any candidates.
+
+	void merge(const assignment_counters_t &counters)
+	{
+		distances += counters.distances;
+		pruned += counters.pruned;
+		skipped += counters.skipped;
+	}
+};
+
+
+
+/*
+ * \brief Diagnostics of one k-means iteration printed in the debug mode. The per-point values
+ *		(SSE and number of reassigned points) are accumulated per thread and merged.
+ */
+struct iteration_diagnostics_t
+{
+	double sse = 0.0;					///< Sum of squared distances to the nearest centroids.
+	std::uint64_t reassigned = 0;		///< Points whose cluster changed (all in the first iteration).
+	std::size_t emptyClusters = 0;
+	double maxShift = 0.0;				///< Largest distance a centroid moved by the update.
+	double time = 0.0;					///< Duration of the iteration in ms.
+
+	void merge(const iteration_diagnostics_t &diagnostics)
+	{
+		sse += diagnostics.sse;
+		reassigned += diagnostics.reassigned;
+	}
+
+	void print(std::ostream &out, std::size_t iteration) const
+	{
+		out << "iteration " << iteration << ": SSE " << sse << ", reassigned " << reassigned << ", max shift "
+			<< maxShift << ", empty clusters " << emptyClusters << ", " << time << " ms" << std::endl;
+	}
+};
+
+
+
+/*
+ * \brief Non-owning view of a contiguous array (pointer and length), so the points
+ *		may reside in any memory (e.g., a memory-mapped file) without being copied.
+ * \tparam T Type of the items (use const type for read-only views).
+ */
+template<typename T>
+class array_view
+{
+private:
+	T *mData;
+	std::size_t mSize;
+
+public:
+	array_view() : mData(nullptr), mSize(0) {}
+	array_view(T *data, std::size_t size) : mData(data), mSize(size) {}
+
+	template<typename U, typename A>
+	array_view(std::vector<U, A> &vec) : mData(vec.data()), mSize(vec.size()) {}
+
+	template<typename U, typename A>
+	array_view(const std::vector<U, A> &vec) : mData(vec.data()), mSize(vec.size()) {}
+
+	// Conversion of mutable view to read-only one.
+	template<typename U>
+	array_view(const array_view<U> &view) : mData(view.data()), mSize(view.size()) {}
+
+	T* data() const { return mData; }
+	std::size_t size() const { return mSize; }
+	bool empty() const { return mSize == 0; }
+
+	T* begin() const { return mData; }
+	T* end() const { return mData + mSize; }
+
+	T& operator[](std::size_t idx) const { return mData[idx]; }
+};
+
+
+/*
+ * \brief Find the nearest and the second-nearest centroid in one pass (ties are resolved in favor
+ *		of lower indices, so the nearest one is the same as in the plain search for the nearest).
+ *		Shared by the implementations which report the second-nearest clusters.
+ * \param distance Functor which returns the squared distance of a point and a centroid.
+ * \param second Receives index of the second-nearest centroid.
+ * \param margin Receives difference of the distances to the second-nearest and the nearest
+ *		centroid (maximal value if there is only one centroid).
+ * \return Index of the nearest centroid.
+ */
+template<typename POINT, typename DIST>
+std::size_t get_nearest_clusters(const POINT &point, array_view<const POINT> centroids, DIST distance,
+	std::size_t &second, std::uint64_t &margin)
+{
+	typedef typename POINT::coord_t coord_t;
+	coord_t minDist = distance(point, centroids[0]), secondDist = std::numeric_limits<coord_t>::max();
+	std::size_t nearest = 0;
+	second = 0;
+	for (std::size_t i = 1; i < centroids.size(); ++i) {
+		// Branch-free updates (conditional moves), the order of the points is unpredictable.
+		coord_t dist = distance(point, centroids[i]);
+		bool first = dist < minDist, next = dist < secondDist;
+		second = first ? nearest : (next ? i : second);
+		secondDist = first ? minDist : (next ? dist : secondDist);
+		nearest = first ? i : nearest;
+		minDist = first ? dist : minDist;
+	}
+
+	margin = (centroids.size() > 1) ? (std::uint64_t)(secondDist - minDist) : std::numeric_limits<std::uint64_t>::max();
+	return nearest;
+}
+
+
+
 /*
  * \brief Interface defining the k-means algorithm wrapper.
  * \tparam POINT Structure type representing points (and centroids).
@@ -27,6 +218,15 @@ struct point_t
 template<typename POINT = point_t, typename ASGN = std::uint8_t, bool DEBUG = false>
 class IKMeans
 {
+protected:
+	array_view<cluster_stats_t> mStats;	///< Where the statistics are gathered (empty if not requested).
+	array_view<ASGN> mSecond;				///< Second-nearest centroids (empty if not requested).
+	array_view<std::uint64_t> mMargins;		///< Margins of the second-nearest centroids.
+	PhaseTimers *mTimers = nullptr;			///< Timers of the phases of compute (null if not measured).
+	TaskTrace *mTrace = nullptr;			///< Timeline of the parallel task bodies (null if not traced).
+	WorkStats *mWork = nullptr;				///< Per-thread work counters of the parallel loops (null if not gathered).
+	std::vector<assignment_counters_t> mAssignmentCounters;	///< One item per iteration (only with WORK_COUNTERS).
+
 public:
 	/*
 	 * \brief Perform the initialization of the functor (e.g., allocate memory buffers).
@@ -36,19 +236,92 @@ public:
 	 */
 	virtual void init(std::size_t points, std::size_t k, std::size_t iters) {}
 
+	/*
+	 * \brief Request statistics of the clusters yielded by the last iteration. They are gathered
+	 *		in the final assignment pass of compute (squared distances to the centroids the points
+	 *		were assigned to), so no extra pass over the points is necessary.
+	 * \param stats Preallocated array (of size k), an empty view disables the statistics.
+	 */
+	void collectStatistics(array_view<cluster_stats_t> stats) { mStats = stats; }
+
+	/*
+	 * \brief Request the second-nearest centroid of every point and its margin (the difference of
+	 *		squared distances to the second-nearest and the nearest centroid) in the last iteration.
+	 *		Both are tracked together with the nearest centroid in the final assignment pass.
+	 *		With a single cluster, the second-nearest is the nearest one and the margin is maximal.
+	 * \param second Preallocated array (of size points.size()), an empty view disables the tracking.
+	 * \param margins Preallocated array (of size points.size()).
+	 */
+	void collectSecondNearest(array_view<ASGN> second, array_view<std::uint64_t> margins)
+	{
+		mSecond = second;
+		mMargins = margins;
+	}
+
+	/*
+	 * \brief Measure phases of compute (every iteration and its assign, reduce and update steps).
+	 */
+	void setTimers(PhaseTimers *timers) { mTimers = timers; }
+
+	/*
+	 * \brief Record the bodies of parallel tasks executed by compute (if the implementation has any).
+	 */
+	void setTrace(TaskTrace *trace) { mTrace = trace; }
+
+	/*
+	 * \brief Gather per-thread work counters of the parallel loops of compute (if the implementation has any).
+	 */
+	void setWorkStats(WorkStats *work) { mWork = work; }
+
+	/*
+	 * \brief Work counters of the assignment steps of the last compute, one item per iteration
+	 *		(empty unless the counters are compiled in, see WORK_COUNTERS).
+	 */
+	const std::vector<assignment_counters_t>& assignmentCounters() const { return mAssignmentCounters; }
+
+	/*
+	 * \brief Estimate of the memory the implementation allocates in init and compute (in bytes,
+	 *		excluding the input and the results). It is used to check the memory limit in advance.
+	 */
+	virtual std::size_t memoryEstimate(std::size_t points, std::size_t k) const
+	{
+		return 0;
+	}
+
+	/*
+	 * \brief Estimate of the data one iteration moves from/to the memory (in bytes, the centroids
+	 *		and the per-cluster accumulators are expected to stay in the caches). It is used by the
+	 *		roofline report. By default, every point is read once.
+	 */
+	virtual std::size_t iterationTraffic(std::size_t points, std::size_t k) const
+	{
+		return points * sizeof(POINT);
+	}
+
 	/*
 	 * \brief Perform the clustering and return the cluster centroids and point assignment
 	 *		yielded by the last iteration.
 	 * \note First k points are taken as initial centroids for first iteration.
-	 * \param points Vector with input points.
+	 * \param points View of the input points (the memory is not owned by the functor).
 	 * \param k Number of clusters.
 	 * \param iters Number of refining iterations.
-	 * \param centroids Vector where the final cluster centroids should be stored.
-	 * \param assignments Vector where the final assignment of the points should be stored.
-	 *		The indices should correspond to point indices in 'points' vector.
+	 * \param centroids Preallocated array (of size k) where the final cluster centroids should be stored.
+	 * \param assignments Preallocated array (of size points.size()) where the final assignment of
+	 *		the points should be stored. The indices should correspond to point indices in 'points' view.
+	 */
+	virtual void compute(array_view<const POINT> points, std::size_t k, std::size_t iters,
+		array_view<POINT> centroids, array_view<ASGN> assignments) = 0;
+
+	/*
+	 * \brief Vector adapter of the compute method above (the vectors are resized to fit the results).
 	 */
-	virtual void compute(const std::vector<POINT> &points, std::size_t k, std::size_t iters,
-		std::vector<POINT> &centroids, std::vector<ASGN> &assignments) = 0;
+	void compute(array_view<const POINT> points, std::size_t k, std::size_t iters,
+		std::vector<POINT> &centroids, std::vector<ASGN> &assignments)
+	{
+		centroids.resize(k);
+		assignments.resize(points.size());
+		compute(points, k, iters, array_view<POINT>(centroids), array_view<ASGN>(assignments));
+	}
 };
 
 
@@ -0,0 +1,151 @@
+#ifndef KMEANS_FRAMEWORK_INTERNAL_MAPPED_FILE_HPP
+#define KMEANS_FRAMEWORK_INTERNAL_MAPPED_FILE_HPP
+
+#include <interface.hpp>
+#include <exception.hpp>
+
+#include <string>
+#include <cstddef>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+/*
+ * \brief Read-only memory mapping of an entire file. The data are read directly from
+ *		the page cache, so nothing is copied and repeated runs do not touch the disk.
+ */
+class MappedFile
+{
+private:
+	void *mData;
+	std::size_t mSize;
+
+public:
+	MappedFile(const std::string &fileName) : mData(nullptr), mSize(0)
+	{
+		int fd = ::open(fileName.c_str(), O_RDONLY);
+		if (fd < 0)
+			throw (bpp::RuntimeError() << "File '" << fileName << "' cannot be opened for reading.");
+
+		struct stat st;
+		if (::fstat(fd, &st) != 0) {
+			::close(fd);
+			throw (bpp::RuntimeError() << "Cannot determine size of file '" << fileName << "'.");
+		}
+
+		mSize = (std::size_t)st.st_size;
+		if (mSize > 0) {
+			mData = ::mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (mData == MAP_FAILED) {
+				::close(fd);
+				throw (bpp::RuntimeError() << "File '" << fileName << "' cannot be mapped into memory.");
+			}
+
+			// The hints are optional, their failure is not an error.
+			::madvise(mData, mSize, MADV_SEQUENTIAL);
+			::madvise(mData, mSize, MADV_WILLNEED);
+#ifdef MADV_HUGEPAGE
+			::madvise(mData, mSize, MADV_HUGEPAGE);
+#endif
+		}
+
+		::close(fd);	// The mapping keeps its own reference to the file.
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	~MappedFile()
+	{
+		if (mData != nullptr)
+			::munmap(mData, mSize);
+	}
+
+	std::size_t size() const { return mSize; }
+
+	/*
+	 * \brief Return view of the file as an array of records (incomplete trailing record is ignored).
+	 */
+	template<typename T>
+	array_view<const T> view() const
+	{
+		return array_view<const T>((const T*)mData, mSize / sizeof(T));
+	}
+};
+
+
+/*
+ * \brief Writable shared memory mapping of an output file of given size. Whatever is stored into
+ *		the view ends up in the file, no explicit write is necessary. The data are stored into
+ *		a temporary file next to the output, which replaces the output only when commit() is
+ *		called, so a failed run keeps the previous results.
+ */
+class MappedOutputFile
+{
+private:
+	void *mData;
+	std::size_t mSize;
+	std::string mFileName;
+	std::string mTempFileName;
+	bool mCommitted;
+
+public:
+	MappedOutputFile(const std::string &fileName, std::size_t size)
+		: mData(nullptr), mSize(size), mFileName(fileName), mTempFileName(fileName + ".part"), mCommitted(false)
+	{
+		int fd = ::open(mTempFileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0)
+			throw (bpp::RuntimeError() << "File '" << mTempFileName << "' cannot be opened for writing.");
+
+		// Allocate the whole file, so the stores into the mapping cannot fail on a full disk (SIGBUS).
+		int err = (mSize > 0) ? ::posix_fallocate(fd, 0, (off_t)mSize) : 0;
+		if (err == 0 && mSize > 0) {
+			mData = ::mmap(nullptr, mSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if (mData == MAP_FAILED)
+				mData = nullptr;
+		}
+		::close(fd);
+
+		if (err != 0 || (mSize > 0 && mData == nullptr)) {
+			::unlink(mTempFileName.c_str());
+			if (err != 0)
+				throw (bpp::RuntimeError() << "Space for " << mSize << " bytes of file '" << mTempFileName << "' cannot be allocated.");
+			throw (bpp::RuntimeError() << "File '" << mTempFileName << "' cannot be mapped into memory.");
+		}
+	}
+
+	MappedOutputFile(const MappedOutputFile&) = delete;
+	MappedOutputFile& operator=(const MappedOutputFile&) = delete;
+
+	~MappedOutputFile()
+	{
+		if (mData != nullptr)
+			::munmap(mData, mSize);
+		if (!mCommitted)
+			::unlink(mTempFileName.c_str());
+	}
+
+	std::size_t size() const { return mSize; }
+
+	template<typename T>
+	array_view<T> view() const
+	{
+		return array_view<T>((T*)mData, mSize / sizeof(T));
+	}
+
+	/*
+	 * \brief Replace the output file by the stored data (the mapping remains valid).
+	 */
+	void commit()
+	{
+		if (!mCommitted && ::rename(mTempFileName.c_str(), mFileName.c_str()) != 0)
+			throw (bpp::RuntimeError() << "File '" << mTempFileName << "' cannot be renamed to '" << mFileName << "'.");
+		mCommitted = true;
+	}
+};
+
+
+#endif
@@ -0,0 +1,177 @@
+#ifndef KMEANS_FRAMEWORK_INTERNAL_MEMORY_USAGE_HPP
+#define KMEANS_FRAMEWORK_INTERNAL_MEMORY_USAGE_HPP
+
+#include <exception.hpp>
+
+#include <memory>
+#include <string>
+#include <atomic>
+#include <limits>
+#include <algorithm>
+#include <new>
+#include <cstdlib>
+#include <cstdint>
+#include <cstddef>
+
+#include <sys/resource.h>
+#include <malloc.h>
+
+
+/*
+ * \brief Process-wide heap allocation counters. They are fed by the replaced global operators
+ *		new and delete (see counted_malloc) and by containers with counting_allocator.
+ *		Nothing is counted until the counting is enabled (only runs which report the memory
+ *		pay for the atomic updates).
+ */
+struct allocation_counters_t
+{
+	std::atomic<bool> enabled;				///< Whether the allocations are counted.
+	std::atomic<std::uint64_t> allocations;	///< Number of allocations.
+	std::atomic<std::uint64_t> allocated;	///< Total bytes allocated (freeing does not decrease it).
+	std::atomic<std::uint64_t> current;		///< Bytes currently allocated.
+	std::atomic<std::uint64_t> peak;		///< Maximum of current.
+
+	void add(std::size_t size)
+	{
+		if (!enabled.load(std::memory_order_relaxed))
+			return;
+		allocations.fetch_add(1, std::memory_order_relaxed);
+		allocated.fetch_add(size, std::memory_order_relaxed);
+		std::uint64_t now = current.fetch_add(size, std::memory_order_relaxed) + size;
+		std::uint64_t max = peak.load(std::memory_order_relaxed);
+		while (now > max && !peak.compare_exchange_weak(max, now, std::memory_order_relaxed));
+	}
+
+	void remove(std::size_t size)
+	{
+		if (!enabled.load(std::memory_order_relaxed))
+			return;
+		// Blocks allocated before the counting was enabled must not make the counter wrap around.
+		std::uint64_t now = current.load(std::memory_order_relaxed);
+		while (!current.compare_exchange_weak(now, now - std::min<std::uint64_t>(now, size), std::memory_order_relaxed));
+	}
+};
+
+
+/*
+ * \brief The counters (zero-initialized statically, so they work before main).
+ */
+inline allocation_counters_t& allocation_counters()
+{
+	static allocation_counters_t counters;
+	return counters;
+}
+
+
+/*
+ * \brief Allocator which counts the allocations of a container and delegates them to the base allocator.
+ */
+template<typename T, typename BASE = std::allocator<T>>
+class counting_allocator : public BASE
+{
+public:
+	typedef T value_type;
+
+	template<typename U>
+	struct rebind
+	{
+		typedef counting_allocator<U, typename std::allocator_traits<BASE>::template rebind_alloc<U>> other;
+	};
+
+	counting_allocator() = default;
+
+	template<typename U, typename B>
+	counting_allocator(const counting_allocator<U, B> &allocator) : BASE(allocator) {}
+
+	T* allocate(std::size_t count)
+	{
+		T *res = std::allocator_traits<BASE>::allocate(*this, count);
+		allocation_counters().add(count * sizeof(T));
+		return res;
+	}
+
+	void deallocate(T *ptr, std::size_t count)
+	{
+		allocation_counters().remove(count * sizeof(T));
+		std::allocator_traits<BASE>::deallocate(*this, ptr, count);
+	}
+
+	template<typename U, typename B>
+	bool operator==(const counting_allocator<U, B>&) const { return true; }
+
+	template<typename U, typename B>
+	bool operator!=(const counting_allocator<U, B>&) const { return false; }
+};
+
+
+/*
+ * \brief Peak resident set size of the process in bytes.
+ */
+inline std::size_t peak_rss()
+{
+	struct rusage usage;
+	if (::getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+	return (std::size_t)usage.ru_maxrss * 1024;	// in kilobytes on Linux
+}
+
+
+/*
+ * \brief Parse a memory size (bytes with an optional K, M or G suffix, powers of 1024).
+ */
+inline std::size_t parse_memory_size(const std::string &str)
+{
+	// Sign is not allowed (stoull would negate the number).
+	if (str.empty() || str[0] < '0' || str[0] > '9')
+		throw (bpp::RuntimeError() << "Invalid memory size '" << str << "'.");
+
+	std::size_t idx;
+	unsigned long long value = std::stoull(str, &idx);
+	std::string suffix = str.substr(idx);
+	std::size_t unit = 1;
+	if (suffix == "K" || suffix == "k")
+		unit = 1024;
+	else if (suffix == "M" || suffix == "m")
+		unit = 1024*1024;
+	else if (suffix == "G" || suffix == "g")
+		unit = 1024*1024*1024;
+	else if (!suffix.empty())
+		throw (bpp::RuntimeError() << "Invalid memory size '" << str << "'.");
+
+	if (value > std::numeric_limits<std::size_t>::max() / unit)
+		throw (bpp::RuntimeError() << "Memory size '" << str << "' is too large.");
+	return (std::size_t)value * unit;
+}
+
+
+/*
+ * \brief Allocate memory from malloc and count it (used by the replaced global operator new).
+ *		The sizes are taken from malloc_usable_size, so the deallocation need not know them.
+ */
+inline void* counted_malloc(std::size_t size)
+{
+	void *ptr = std::malloc(size ? size : 1);
+	if (ptr == nullptr)
+		throw std::bad_alloc();
+	allocation_counters_t &counters = allocation_counters();
+	if (counters.enabled.load(std::memory_order_relaxed))
+		counters.add(::malloc_usable_size(ptr));
+	return ptr;
+}
+
+
+/*
+ * \brief Free memory allocated by counted_malloc.
+ */
+inline void counted_free(void *ptr)
+{
+	if (ptr == nullptr)
+		return;
+	allocation_counters_t &counters = allocation_counters();
+	if (counters.enabled.load(std::memory_order_relaxed))
+		counters.remove(::malloc_usable_size(ptr));
+	std::free(ptr);
+}
+
+
+#endif
@@ -0,0 +1,147 @@
+#ifndef KMEANS_FRAMEWORK_INTERNAL_PARALLEL_IO_HPP
+#define KMEANS_FRAMEWORK_INTERNAL_PARALLEL_IO_HPP
+
+#include <interface.hpp>
+#include <exception.hpp>
+#include <workers.hpp>
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstddef>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+
+/*
+ * \brief Positional file I/O that splits the data into aligned ranges which are
+ *		transferred concurrently (pread/pwrite) by a group of worker threads.
+ */
+class ParallelIO
+{
+private:
+	int mFd;
+	std::string mFileName;
+	std::size_t mRangeSize;
+	std::size_t mThreads;
+
+	/*
+	 * \brief Transfer one range completely (repeats on short transfers and interrupts).
+	 */
+	template<bool WRITE>
+	void transferRange(char *data, std::size_t size, std::size_t offset)
+	{
+		while (size > 0) {
+			ssize_t res = WRITE
+				? ::pwrite(mFd, data, size, (off_t)offset)
+				: ::pread(mFd, data, size, (off_t)offset);
+			if (res < 0 && errno == EINTR) continue;
+			if (res <= 0)
+				throw (bpp::RuntimeError() << "Error while " << (WRITE ? "writing data to" : "reading from") << " file '" << mFileName << "'.");
+			data += res;
+			offset += (std::size_t)res;
+			size -= (std::size_t)res;
+		}
+	}
+
+	/*
+	 * \brief Split the buffer into ranges and let the workers pick them up one by one.
+	 */
+	template<bool WRITE>
+	void transfer(char *data, std::size_t size)
+	{
+		std::size_t ranges = (size + mRangeSize - 1) / mRangeSize;
+		run_tasks(ranges, [&](std::size_t range) {
+			std::size_t offset = range * mRangeSize;
+			transferRange<WRITE>(data + offset, std::min(mRangeSize, size - offset), offset);
+		}, mThreads);
+	}
+
+public:
+	/*
+	 * \param fileName Path to the file.
+	 * \param write Whether the file is opened (and truncated) for writing.
+	 * \param rangeSize Size of one range in bytes (multiple of the page size).
+	 * \param threads Number of concurrent workers (0 = hardware concurrency).
+	 */
+	ParallelIO(const std::string &fileName, bool write, std::size_t rangeSize = 4*1024*1024, std::size_t threads = 0)
+		: mFileName(fileName), mRangeSize(rangeSize), mThreads(threads)
+	{
+		mFd = write ? ::open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644) : ::open(fileName.c_str(), O_RDONLY);
+		if (mFd < 0)
+			throw (bpp::RuntimeError() << "File '" << fileName << "' cannot be opened for " << (write ? "writing." : "reading."));
+	}
+
+	ParallelIO(const ParallelIO&) = delete;
+	ParallelIO& operator=(const ParallelIO&) = delete;
+
+	~ParallelIO()
+	{
+		::close(mFd);
+	}
+
+	std::size_t size() const
+	{
+		struct stat st;
+		if (::fstat(mFd, &st) != 0)
+			throw (bpp::RuntimeError() << "Cannot determine size of file '" << mFileName << "'.");
+		return (std::size_t)st.st_size;
+	}
+
+	void read(void *data, std::size_t size)
+	{
+		transfer<false>((char*)data, size);
+	}
+
+	void write(const void *data, std::size_t size)
+	{
+		// Pre-size the file, so the ranges can be written in any order.
+		if (::ftruncate(mFd, (off_t)size) != 0)
+			throw (bpp::RuntimeError() << "Error while writing data to file '" << mFileName << "'.");
+		transfer<true>((char*)data, size);
+	}
+};
+
+
+/*
+ * \brief Load an entire file into a vector of records using concurrent pread calls.
+ */
+template<typename T>
+void load_file_parallel(const std::string &fileName, std::vector<T> &res)
+{
+	ParallelIO file(fileName, false);
+	res.resize(file.size() / sizeof(T));
+	file.read(res.data(), res.size() * sizeof(T));
+}
+
+
+/*
+ * \brief Read an entire file into a prepared array of records (its size must match the file)
+ *		using concurrent pread calls.
+ * \param threads Number of concurrent workers (0 = hardware concurrency).
+ */
+template<typename T>
+void read_file_parallel(const std::string &fileName, array_view<T> res, std::size_t threads = 0)
+{
+	ParallelIO file(fileName, false, 4*1024*1024, threads);
+	if (file.size() / sizeof(T) != res.size())
+		throw (bpp::RuntimeError() << "File '" << fileName << "' has changed while being loaded.");
+	file.read(res.data(), res.size() * sizeof(T));
+}
+
+
+/*
+ * \brief Save an array of records into a file using concurrent pwrite calls.
+ */
+template<typename T>
+void save_file_parallel(const std::string &fileName, array_view<const T> data)
+{
+	ParallelIO file(fileName, true);
+	file.write(data.data(), data.size() * sizeof(T));
+}
+
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef KMEANS_FRAMEWORK_INTERNAL_PERF_COUNTERS_HPP
+#define KMEANS_FRAMEWORK_INTERNAL_PERF_COUNTERS_HPP
+
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <cstddef>
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+/*
+ * \brief Hardware performance counters (cycles, instructions, LLC misses and branch misses)
+ *		of the process, read via perf_event_open. The counters are inherited, so the kernel keeps
+ *		one instance per thread created after opening them (worker threads included) and sums them
+ *		on read. Therefore the counters must be opened before any worker threads are spawned.
+ *		Counters which cannot be opened (e.g., in containers or VMs) are simply not available.
+ */
+class PerfCounters
+{
+public:
+	static const std::size_t COUNT = 4;
+
+private:
+	int mFds[COUNT];
+	std::string mError;
+
+	static std::uint64_t config(std::size_t counter)
+	{
+		switch (counter) {
+		case 0: return PERF_COUNT_HW_CPU_CYCLES;
+		case 1: return PERF_COUNT_HW_INSTRUCTIONS;
+		case 2: return PERF_COUNT_HW_CACHE_MISSES;
+		default: return PERF_COUNT_HW_BRANCH_MISSES;
+		}
+	}
+
+public:
+	/*
+	 * \brief Open all the counters and start counting (user space only).
+	 */
+	PerfCounters()
+	{
+		for (std::size_t i = 0; i < COUNT; ++i) {
+			perf_event_attr attr;
+			std::memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.config = config(i);
+			attr.inherit = 1;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+			mFds[i] = (int)::syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+			if (mFds[i] < 0 && mError.empty())
+				mError = std::string("Counter ") + name(i) + " cannot be opened (" + std::strerror(errno) + ").";
+		}
+	}
+
+	~PerfCounters()
+	{
+		for (std::size_t i = 0; i < COUNT; ++i)
+			if (mFds[i] >= 0) ::close(mFds[i]);
+	}
+
+	PerfCounters(const PerfCounters&) = delete;
+	PerfCounters& operator=(const PerfCounters&) = delete;
+
+	/*
+	 * \brief Name of given counter (used in reports).
+	 */
+	static const char* name(std::size_t counter)
+	{
+		static const char* const names[COUNT] = { "cycles", "instructions", "llc_misses", "branch_misses" };
+		return names[counter];
+	}
+
+	bool available(std::size_t counter) const
+	{
+		return mFds[counter] >= 0;
+	}
+
+	/*
+	 * \brief Whether at least one counter is available.
+	 */
+	bool available() const
+	{
+		for (std::size_t i = 0; i < COUNT; ++i)
+			if (available(i)) return true;
+		return false;
+	}
+
+	/*
+	 * \brief Reason why (the first of) the counters are not available (empty if all are).
+	 */
+	const std::string& error() const
+	{
+		return mError;
+	}
+
+	/*
+	 * \brief Read current values of all the counters (zeros for unavailable ones). Values of
+	 *		multiplexed counters are scaled by the ratio of their enabled and running times.
+	 */
+	void read(std::uint64_t values[COUNT]) const
+	{
+		for (std::size_t i = 0; i < COUNT; ++i) {
+			std::uint64_t data[3] = { 0, 0, 0 };	// value, time enabled, time running
+			values[i] = 0;
+			if (!available(i) || ::read(mFds[i], data, sizeof(data)) != (ssize_t)sizeof(data))
+				continue;
+			values[i] = (data[2] > 0 && data[2] < data[1])
+				? (std::uint64_t)((double)data[0] * (double)data[1] / (double)data[2])
+				: data[0];
+		}
+	}
+};
+
+
+#endif
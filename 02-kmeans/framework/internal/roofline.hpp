@@ -0,0 +1,141 @@
+#ifndef KMEANS_FRAMEWORK_INTERNAL_ROOFLINE_HPP
+#define KMEANS_FRAMEWORK_INTERNAL_ROOFLINE_HPP
+
+#include <interface.hpp>
+#include <workers.hpp>
+#include <stopwatch.hpp>
+
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <numeric>
+#include <limits>
+#include <cstdint>
+#include <cstddef>
+
+
+/*
+ * \brief Work of one k-means iteration: the distances of every point to all the centroids
+ *		and the memory traffic of the implementation (see IKMeans::iterationTraffic).
+ */
+struct iteration_work_t
+{
+	double bytes;		///< Bytes moved from/to the memory.
+	double distances;	///< Point-centroid distance evaluations.
+
+	iteration_work_t(std::size_t points, std::size_t k, std::size_t traffic)
+		: bytes((double)traffic), distances((double)points * (double)k) {}
+
+	/*
+	 * \brief Arithmetic intensity (distances per byte).
+	 */
+	double intensity() const
+	{
+		return (bytes > 0.0) ? distances / bytes : 0.0;
+	}
+};
+
+
+/*
+ * \brief Measure peak memory bandwidth of the machine (in GB/s) by a STREAM-like triad
+ *		(a = b + s*c) over arrays which do not fit into the caches. All hardware threads take
+ *		part, the best of several repetitions is taken. The triad moves 3 doubles per item
+ *		(the write-allocate traffic is not counted, the same way STREAM does).
+ * \param size Size of each of the three arrays in bytes.
+ */
+inline double measure_peak_bandwidth(std::size_t size = 64*1024*1024, std::size_t repetitions = 4)
+{
+	std::size_t count = size / sizeof(double);
+	std::size_t blocks = std::max<std::size_t>(std::thread::hardware_concurrency(), 1);
+	std::size_t blockSize = (count + blocks - 1) / blocks;
+	std::vector<double> a(count), b(count), c(count);
+
+	auto triad = [&](double scalar) {
+		run_tasks(blocks, [&](std::size_t block) {
+			std::size_t end = std::min(count, (block + 1) * blockSize);
+			for (std::size_t i = block * blockSize; i < end; ++i)
+				a[i] = b[i] + scalar * c[i];
+		}, blocks);
+	};
+
+	// The first pass initializes the data (pages are faulted in by the threads which use them).
+	run_tasks(blocks, [&](std::size_t block) {
+		std::size_t end = std::min(count, (block + 1) * blockSize);
+		for (std::size_t i = block * blockSize; i < end; ++i) {
+			b[i] = 1.0;
+			c[i] = 2.0;
+		}
+	}, blocks);
+	triad(1.0);
+
+	double best = 0.0;
+	for (std::size_t r = 0; r < repetitions; ++r) {
+		bpp::Stopwatch stopwatch(true);
+		triad(0.5 + (double)r);
+		stopwatch.stop();
+		if (stopwatch.getSeconds() > 0.0)
+			best = std::max(best, 3.0 * (double)count * sizeof(double) / stopwatch.getSeconds() * 1e-9);
+	}
+	return best;
+}
+
+
+
+/*
+ * \brief Measure peak distance throughput of the machine (in G distances/s) by the search for
+ *		the nearest centroid over points and centroids which stay in the L1 cache, so the memory
+ *		does not limit it. All hardware threads take part, the best of several repetitions is taken.
+ * \param k Number of centroids (as in the measured computation).
+ */
+inline double measure_peak_distances(std::size_t k, std::size_t repetitions = 4)
+{
+	typedef point_t::coord_t coord_t;
+	const std::size_t POINTS = 1024;
+	std::size_t threads = std::max<std::size_t>(std::thread::hardware_concurrency(), 1);
+	std::size_t passes = (std::size_t)(1 << 24) / (POINTS * k) + 1;
+
+	std::vector<point_t> points(POINTS), centroids(k);
+	for (std::size_t i = 0; i < POINTS; ++i)
+		points[i] = point_t{ (coord_t)(i * 7919 % 10007), (coord_t)(i * 104729 % 10009) };
+	for (std::size_t i = 0; i < k; ++i)
+		centroids[i] = point_t{ (coord_t)(i * 31337 % 10007), (coord_t)(i * 2713 % 10009) };
+
+	// The points are shifted in every pass, so the passes cannot be merged by the compiler.
+	std::vector<std::size_t> sinks(threads);
+	auto search = [&]() {
+		run_tasks(threads, [&](std::size_t thread) {
+			std::size_t sink = 0;
+			for (std::size_t pass = 0; pass < passes; ++pass)
+				for (std::size_t i = 0; i < POINTS; ++i) {
+					std::int64_t x = points[i].x + (coord_t)pass, y = points[i].y;
+					std::int64_t minDist = std::numeric_limits<std::int64_t>::max();
+					std::size_t nearest = 0;
+					for (std::size_t c = 0; c < k; ++c) {
+						std::int64_t dx = x - centroids[c].x, dy = y - centroids[c].y;
+						std::int64_t dist = dx*dx + dy*dy;
+						nearest = (dist < minDist) ? c : nearest;
+						minDist = std::min(minDist, dist);
+					}
+					sink += nearest;
+				}
+			sinks[thread] += sink;
+		}, threads);
+	};
+
+	search();
+	double best = 0.0;
+	for (std::size_t r = 0; r < repetitions; ++r) {
+		bpp::Stopwatch stopwatch(true);
+		search();
+		stopwatch.stop();
+		if (stopwatch.getSeconds() > 0.0)
+			best = std::max(best, (double)(threads * passes * POINTS * k) / stopwatch.getSeconds() * 1e-9);
+	}
+
+	volatile std::size_t sink = std::accumulate(sinks.begin(), sinks.end(), (std::size_t)0);
+	(void)sink;
+	return best;
+}
+
+
+#endif
@@ -0,0 +1,144 @@
+#ifndef KMEANS_FRAMEWORK_INTERNAL_SHARDS_HPP
+#define KMEANS_FRAMEWORK_INTERNAL_SHARDS_HPP
+
+#include <interface.hpp>
+#include <exception.hpp>
+#include <workers.hpp>
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstddef>
+
+#include <glob.h>
+#include <sys/stat.h>
+
+
+/*
+ * \brief Whether the points file specification denotes a set of shards (a comma-separated list
+ *		and/or glob patterns). An existing file is never taken for a list, whatever its name is.
+ */
+inline bool is_sharded_input(const std::string &spec)
+{
+	struct stat st;
+	return spec.find_first_of(",*?[") != std::string::npos && ::stat(spec.c_str(), &st) != 0;
+}
+
+
+/*
+ * \brief Expand a comma-separated list of file names and glob patterns into the list of shards.
+ *		Matches of each pattern are sorted by name, the order of the list items is preserved.
+ */
+inline std::vector<std::string> expand_shards(const std::string &spec)
+{
+	std::vector<std::string> res;
+	std::size_t begin = 0;
+	while (begin <= spec.length()) {
+		std::size_t end = std::min(spec.find(',', begin), spec.length());
+		std::string item = spec.substr(begin, end - begin);
+		begin = end + 1;
+		if (item.empty())
+			continue;
+
+		if (item.find_first_of("*?[") == std::string::npos) {
+			res.push_back(item);
+			continue;
+		}
+
+		glob_t matches;
+		int err = ::glob(item.c_str(), 0, nullptr, &matches);
+		if (err == GLOB_NOMATCH)
+			throw (bpp::RuntimeError() << "Pattern '" << item << "' does not match any file.");
+		if (err != 0)
+			throw (bpp::RuntimeError() << "Pattern '" << item << "' cannot be expanded.");
+		for (std::size_t i = 0; i < matches.gl_pathc; ++i)
+			res.push_back(matches.gl_pathv[i]);
+		::globfree(&matches);
+	}
+
+	if (res.empty())
+		throw (bpp::RuntimeError() << "No input files given in '" << spec << "'.");
+	return res;
+}
+
+
+/*
+ * \brief Returned by the shard counting functor of load_shards if the number of points in a shard
+ *		is not known until the shard is loaded (e.g., text files).
+ */
+static const std::size_t UNKNOWN_SHARD_SIZE = ~(std::size_t)0;
+
+
+/*
+ * \brief Load all shards concurrently into one contiguous array of points. The numbers of points
+ *		in the shards are determined first, so the shards are read directly at their places in
+ *		the result. Only the shards of unknown size are loaded separately and copied there.
+ * \param shards Names of the shard files.
+ * \param count Functor (const std::string&) which returns the number of points in one file
+ *		(or UNKNOWN_SHARD_SIZE).
+ * \param read Functor (const std::string&, array_view<point_t>) which reads one file of known size.
+ * \param load Functor (const std::string&, std::vector<point_t>&) which loads one file of unknown size.
+ * \param res Vector where all the points are stored (in the order of the shards).
+ * \param offsets Receives index of the first point of each shard (plus the total count at the end).
+ */
+template<typename COUNT, typename READ, typename LOAD>
+void load_shards(const std::vector<std::string> &shards, COUNT count, READ read, LOAD load,
+	std::vector<point_t> &res, std::vector<std::size_t> &offsets)
+{
+	std::vector<std::vector<point_t>> parts(shards.size());
+	std::vector<char> loaded(shards.size(), 0);
+	offsets.assign(shards.size() + 1, 0);
+	run_tasks(shards.size(), [&](std::size_t i) {
+		std::size_t size = count(shards[i]);
+		if (size == UNKNOWN_SHARD_SIZE) {
+			load(shards[i], parts[i]);
+			size = parts[i].size();
+			loaded[i] = 1;
+		}
+		offsets[i + 1] = size;
+	});
+
+	for (std::size_t i = 0; i < shards.size(); ++i)
+		offsets[i + 1] += offsets[i];
+
+	if (shards.size() == 1 && loaded[0]) {
+		res.swap(parts[0]);
+		return;
+	}
+
+	res.resize(offsets.back());
+	run_tasks(shards.size(), [&](std::size_t i) {
+		if (loaded[i]) {
+			std::copy(parts[i].begin(), parts[i].end(), res.begin() + offsets[i]);
+			std::vector<point_t>().swap(parts[i]);
+		}
+		else
+			read(shards[i], array_view<point_t>(res.data() + offsets[i], offsets[i + 1] - offsets[i]));
+	});
+}
+
+
+/*
+ * \brief Name of the output file which corresponds to given shard.
+ */
+inline std::string shard_file_name(const std::string &fileName, std::size_t shard)
+{
+	return fileName + "." + std::to_string(shard);
+}
+
+
+/*
+ * \brief Save the data split into the same layout as the input shards (one file per shard,
+ *		named <fileName>.<shard index>). The files are written concurrently.
+ * \param save Functor (const std::string&, array_view<const T>) which saves one file.
+ */
+template<typename T, typename SAVE>
+void save_shards(const std::string &fileName, const std::vector<std::size_t> &offsets, array_view<const T> data, SAVE save)
+{
+	run_tasks(offsets.size() - 1, [&](std::size_t i) {
+		save(shard_file_name(fileName, i), array_view<const T>(data.data() + offsets[i], offsets[i + 1] - offsets[i]));
+	});
+}
+
+
+#endif
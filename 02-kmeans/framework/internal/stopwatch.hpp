@@ -42,8 +42,9 @@ private:
 		::QueryPerformanceCounter(&ticks);
 		return static_cast<ticks_t>(ticks.QuadPart);
 #else
+		// Monotonic clock is not affected by adjustments of the system time (it cannot jump).
 		struct timespec ts;
-		::clock_gettime(CLOCK_REALTIME, &ts);
+		::clock_gettime(CLOCK_MONOTONIC, &ts);
 		return static_cast<ticks_t>(ts.tv_sec) * 1000000000UL + static_cast<ticks_t>(ts.tv_nsec);
 #endif
 	}
@@ -68,13 +69,13 @@ public:
 	/**
 	 * \brief Create new stopwatch. The stopwatch are not running when created.
 	 */
-	Stopwatch() : mTiming(false) { }
+	Stopwatch() : mStartTime(0), mLastInterval(0.0), mTiming(false) { }
 
 	/**
 	 * \brief Create new stopwatch (and optionaly start it).
 	 * \param start If start is true, the stapwatch are started immediately.
 	 */
-	Stopwatch(bool start)
+	Stopwatch(bool start) : mStartTime(0), mLastInterval(0.0), mTiming(false)
 	{
 		if (start) this->start();
 	}
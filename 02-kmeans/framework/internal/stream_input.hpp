@@ -0,0 +1,107 @@
+#ifndef KMEANS_FRAMEWORK_INTERNAL_STREAM_INPUT_HPP
+#define KMEANS_FRAMEWORK_INTERNAL_STREAM_INPUT_HPP
+
+#include <interface.hpp>
+#include <exception.hpp>
+#include <dataset.hpp>
+#include <compressed.hpp>
+#include <text_points.hpp>
+
+#include <vector>
+#include <string>
+#include <limits>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <cstddef>
+
+
+/*
+ * \brief Read up to 'size' bytes from a stream (less only at its end), repeating short reads of pipes.
+ */
+inline std::size_t read_stream(std::FILE *fp, const std::string &name, void *data, std::size_t size)
+{
+	std::size_t total = 0;
+	while (total < size) {
+		std::size_t res = std::fread((char*)data + total, 1, size - total, fp);
+		if (res == 0) {
+			if (std::ferror(fp))
+				throw (bpp::RuntimeError() << "Error while reading from " << name << ".");
+			break;
+		}
+		total += res;
+	}
+	return total;
+}
+
+
+/*
+ * \brief Load points from a non-seekable stream (stdin or a pipe). The format is detected
+ *		from the first bytes: headered datasets are read and converted batch by batch (the store
+ *		grows with the data, the declared count cannot be trusted before they are read), raw
+ *		records are read directly into the (geometrically growing) point store. Compressed
+ *		and text data require random access, so they are gathered first and then decoded.
+ * \param fp The stream.
+ * \param name Name of the stream (for error messages).
+ * \param text Whether the data are text (cannot be detected reliably).
+ * \param res Vector where the points are stored.
+ */
+inline void load_stream(std::FILE *fp, const std::string &name, bool text, std::vector<point_t> &res)
+{
+	const std::size_t batchSize = 1024*1024;	// in records
+
+	char head[sizeof(dataset_header_t)];
+	std::size_t headSize = read_stream(fp, name, head, sizeof(head));
+
+	if (dataset_header_t::matches(head, headSize) && !text) {
+		dataset_header_t header;
+		std::memcpy(&header, head, sizeof(header));
+		header.validate(name, std::numeric_limits<std::size_t>::max());	// the size is not known in advance
+
+		// The count is not verified by the size, so the store grows only with the data actually read.
+		res.clear();
+		read_dataset_batches(fp, name, header, [&](std::size_t offset, std::size_t count) {
+			if (res.size() < offset + count)
+				res.resize(offset + count);
+			return &res[offset];
+		});
+		if (res.size() != header.count)
+			throw (bpp::RuntimeError() << "The " << name << " holds " << res.size() << " points, but its header declares " << header.count << ".");
+		return;
+	}
+
+	if (text || compressed_header_t::matches(head, headSize)) {
+		std::vector<char> data(head, head + headSize);
+		std::size_t size = headSize;
+		do {
+			data.resize(std::max<std::size_t>(size * 2, batchSize * sizeof(point_t)));
+			size += read_stream(fp, name, data.data() + size, data.size() - size);
+		} while (size == data.size());
+		data.resize(size);
+
+		if (text)
+			parse_text_points(name, data.data(), data.size(), res);
+		else
+			decode_compressed(name, data.data(), data.size(), res);
+		return;
+	}
+
+	// Raw records, the first ones are already in the head buffer. The stream is read directly
+	// into the store, which is doubled whenever it gets full.
+	res.resize(batchSize);
+	std::memcpy(res.data(), head, headSize);
+	std::size_t size = headSize;	// in bytes
+	for (;;) {
+		std::size_t space = res.size() * sizeof(point_t) - size;
+		std::size_t got = read_stream(fp, name, (char*)res.data() + size, space);
+		size += got;
+		if (got < space)
+			break;
+		res.resize(res.size() * 2);
+	}
+
+	res.resize(size / sizeof(point_t));	// incomplete trailing record is ignored
+}
+
+
+#endif
@@ -0,0 +1,163 @@
+#ifndef KMEANS_FRAMEWORK_INTERNAL_TASK_TRACE_HPP
+#define KMEANS_FRAMEWORK_INTERNAL_TASK_TRACE_HPP
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <ostream>
+#include <iomanip>
+#include <cstdint>
+#include <cstddef>
+
+#include <time.h>
+
+
+/*
+ * \brief Timeline of task bodies executed by the worker threads, exported in the Chrome trace
+ *		format (chrome://tracing, Perfetto). Every thread records its events into its own ring
+ *		buffer without any locking (only the first event of a thread registers its buffer), when
+ *		a buffer gets full, the oldest events are overwritten.
+ * \note The buffers may be written only while no thread reads them (i.e., dump after the computation).
+ */
+class TaskTrace
+{
+private:
+	struct event_t
+	{
+		const char *name;
+		std::uint64_t start;	///< In nanoseconds since the trace was created.
+		std::uint64_t end;
+		std::uint64_t size;		///< Size of the task (e.g., number of items of the range).
+	};
+
+	struct thread_buffer_t
+	{
+		std::vector<event_t> events;
+		std::uint64_t recorded = 0;	///< Total number of events (the ring position is recorded % capacity).
+	};
+
+	std::size_t mCapacity;
+	std::uint64_t mId;
+	std::uint64_t mOrigin;
+	std::mutex mMutex;
+	std::vector<std::unique_ptr<thread_buffer_t>> mBuffers;
+
+	static std::uint64_t clock()
+	{
+		struct timespec ts;
+		::clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (std::uint64_t)ts.tv_sec * 1000000000ULL + (std::uint64_t)ts.tv_nsec;
+	}
+
+	/*
+	 * \brief Buffer of the calling thread (it is registered on the first use).
+	 */
+	thread_buffer_t& local()
+	{
+		// The cache is keyed by unique trace ids, so a new trace never gets a stale buffer.
+		thread_local std::uint64_t cachedId = 0;
+		thread_local thread_buffer_t *cachedBuffer = nullptr;
+		if (cachedId != mId) {
+			std::lock_guard<std::mutex> lock(mMutex);
+			mBuffers.emplace_back(new thread_buffer_t());
+			mBuffers.back()->events.resize(mCapacity);
+			cachedBuffer = mBuffers.back().get();
+			cachedId = mId;
+		}
+		return *cachedBuffer;
+	}
+
+public:
+	/*
+	 * \param capacity Size of the ring buffer of each thread (in events).
+	 */
+	TaskTrace(std::size_t capacity = 64*1024) : mCapacity(std::max<std::size_t>(capacity, 1)), mOrigin(clock())
+	{
+		static std::atomic<std::uint64_t> lastId(0);
+		mId = ++lastId;
+	}
+
+	TaskTrace(const TaskTrace&) = delete;
+	TaskTrace& operator=(const TaskTrace&) = delete;
+
+	/*
+	 * \brief Current timestamp (to be passed as the start of a recorded event).
+	 */
+	std::uint64_t now() const
+	{
+		return clock() - mOrigin;
+	}
+
+	/*
+	 * \brief Record an event of the calling thread which started at given time and ends now.
+	 * \param name Static string with the name of the task.
+	 */
+	void record(const char *name, std::uint64_t start, std::uint64_t size)
+	{
+		thread_buffer_t &buffer = local();
+		buffer.events[buffer.recorded++ % mCapacity] = event_t{ name, start, now(), size };
+	}
+
+	/*
+	 * \brief Write all recorded events as Chrome trace JSON (complete events, one track per thread).
+	 *		Number of events dropped from full buffers is saved in the metadata of the threads.
+	 */
+	void writeJson(std::ostream &out)
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		std::ios::fmtflags flags = out.flags();
+		std::streamsize precision = out.precision();
+		out << std::fixed << std::setprecision(3);	// timestamps are in microseconds
+
+		out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+		const char *separator = "\n";
+		for (std::size_t tid = 0; tid < mBuffers.size(); ++tid) {
+			const thread_buffer_t &buffer = *mBuffers[tid];
+			std::uint64_t dropped = buffer.recorded > mCapacity ? buffer.recorded - mCapacity : 0;
+			out << separator << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid
+				<< ",\"args\":{\"name\":\"worker " << tid << "\",\"dropped\":" << dropped << "}}";
+			separator = ",\n";
+
+			for (std::uint64_t i = dropped; i < buffer.recorded; ++i) {
+				const event_t &event = buffer.events[i % mCapacity];
+				out << ",\n{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid
+					<< ",\"ts\":" << (double)event.start * 1e-3 << ",\"dur\":" << (double)(event.end - event.start) * 1e-3
+					<< ",\"args\":{\"size\":" << event.size << "}}";
+			}
+		}
+		out << "\n]}\n";
+
+		out.flags(flags);
+		out.precision(precision);
+	}
+};
+
+
+/*
+ * \brief Records execution of a task body for the duration of a scope (nothing if the trace is null).
+ */
+class TraceScope
+{
+private:
+	TaskTrace *mTrace;
+	const char *mName;
+	std::uint64_t mSize;
+	std::uint64_t mStart;
+
+public:
+	TraceScope(TaskTrace *trace, const char *name, std::uint64_t size)
+		: mTrace(trace), mName(name), mSize(size), mStart(trace ? trace->now() : 0) {}
+
+	TraceScope(const TraceScope&) = delete;
+	TraceScope& operator=(const TraceScope&) = delete;
+
+	~TraceScope()
+	{
+		if (mTrace) mTrace->record(mName, mStart, mSize);
+	}
+};
+
+
+#endif
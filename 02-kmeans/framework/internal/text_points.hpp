@@ -0,0 +1,294 @@
+#ifndef KMEANS_FRAMEWORK_INTERNAL_TEXT_POINTS_HPP
+#define KMEANS_FRAMEWORK_INTERNAL_TEXT_POINTS_HPP
+
+#include <interface.hpp>
+#include <exception.hpp>
+#include <workers.hpp>
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <thread>
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+
+
+/*
+ * \brief Parser of points stored as text, one point per line with two integer coordinates
+ *		separated by commas, semicolons, spaces or tabs (CSV or whitespace-separated files).
+ *		The lines are parsed by a plain scalar loop which also validates them, chunks of lines
+ *		are parsed concurrently directly into their places in the result.
+ */
+class TextPointsParser
+{
+private:
+	static const std::size_t MAX_DIGITS = 19;
+	static const std::size_t MAX_FAST_DIGITS = 18;	///< Numbers which cannot overflow.
+
+	const char *mData;
+	std::size_t mSize;
+	std::string mFileName;
+
+	static bool isDigit(char c) { return c >= '0' && c <= '9'; }
+	static bool isSign(char c) { return c == '-' || c == '+'; }
+	static bool isDelimiter(char c) { return c == ',' || c == ';' || c == ' ' || c == '\t' || c == '\r'; }
+
+	std::size_t lineOf(std::size_t offset) const
+	{
+		return (std::size_t)std::count(mData, mData + offset, '\n') + 1;
+	}
+
+	void error(std::size_t offset, const char *message) const
+	{
+		throw (bpp::RuntimeError() << "Invalid text input at line " << lineOf(offset) << " of file '" << mFileName << "': " << message);
+	}
+
+	/*
+	 * \brief Parse a line of the usual form ("x,y", optionally negative numbers and CRLF) which
+	 *		starts at given position (a line break must follow, it stops the scanning of digits)
+	 *		and move the position to the next line. False is returned for any other line, it has
+	 *		to be parsed by parseLine (which also reports errors).
+	 */
+	static bool parseLineFast(const char *&line, point_t &point)
+	{
+		const char *ptr = line;
+		point_t::coord_t coords[2];
+		for (std::size_t i = 0; i < 2; ++i) {
+			bool negative = (*ptr == '-');
+			ptr += negative;
+			const char *start = ptr;
+			std::uint64_t value = 0;
+			while (isDigit(*ptr))
+				value = value * 10 + (std::uint64_t)(*ptr++ - '0');
+			if (ptr == start || ptr - start > (std::ptrdiff_t)MAX_FAST_DIGITS)
+				return false;
+			coords[i] = negative ? -(point_t::coord_t)value : (point_t::coord_t)value;
+
+			char delimiter = *ptr++;
+			if (i == 0 ? (!isDelimiter(delimiter) || delimiter == '\r') : (delimiter == '\r' && *ptr++ != '\n') || (delimiter != '\r' && delimiter != '\n'))
+				return false;
+		}
+		point = point_t{ coords[0], coords[1] };
+		line = ptr;
+		return true;
+	}
+
+	/*
+	 * \brief Parse one line which starts at given offset, store its point (empty lines are skipped)
+	 *		and return the offset of the next line.
+	 */
+	template<typename OUT>
+	std::size_t parseLine(std::size_t offset, std::size_t end, OUT &out) const
+	{
+		point_t::coord_t coords[2];
+		std::size_t fields = 0;
+		while (offset < end) {
+			char c = mData[offset];
+			if (isDelimiter(c)) {
+				++offset;
+				continue;
+			}
+			if (c == '\n')
+				break;
+			if (!isDigit(c) && !isSign(c))
+				error(offset, "unexpected character.");
+			if (fields == 2)
+				error(offset, "expected two coordinates.");
+
+			bool negative = (c == '-');
+			if (isSign(c)) ++offset;
+			std::size_t start = offset;
+			std::size_t last = std::min(end, start + MAX_DIGITS);
+			std::uint64_t value = 0;
+			while (offset < last && isDigit(mData[offset]))
+				value = value * 10 + (std::uint64_t)(mData[offset++] - '0');
+
+			if (offset == start)
+				error(offset, "misplaced sign.");
+			if (offset < end && !isDelimiter(mData[offset]) && mData[offset] != '\n')
+				error(offset, isDigit(mData[offset]) ? "number is too long." : "unexpected character after a number.");
+			if (value > (std::uint64_t)INT64_MAX + (negative ? 1 : 0))
+				error(start, "number out of range.");
+			coords[fields++] = negative ? (point_t::coord_t)(0 - value) : (point_t::coord_t)value;
+		}
+
+		if (fields == 2)
+			out(point_t{ coords[0], coords[1] });
+		else if (fields != 0)
+			error(offset, "expected two coordinates.");
+		return offset + 1;	// skip the line break
+	}
+
+	/*
+	 * \brief Count lines in [begin, end) (an unterminated last line included).
+	 */
+	std::size_t countLines(std::size_t begin, std::size_t end) const
+	{
+		// The 8-bit partial counts let the compiler vectorize the inner loop.
+		const std::size_t BATCH = 240;
+		std::size_t lines = 0, offset = begin;
+		for (; offset + BATCH <= end; offset += BATCH) {
+			std::uint8_t count = 0;
+			for (std::size_t i = 0; i < BATCH; ++i)
+				count += (mData[offset + i] == '\n');
+			lines += count;
+		}
+		for (; offset < end; ++offset)
+			lines += (mData[offset] == '\n');
+		return lines + (mData[end - 1] != '\n' ? 1 : 0);
+	}
+
+	/*
+	 * \brief Parse all lines in [begin, end), the points are passed to given functor.
+	 */
+	template<typename OUT>
+	void parseChunk(std::size_t begin, std::size_t end, OUT out) const
+	{
+		// The fast path is used only where a line break follows (so it needs no bound checks).
+		std::size_t lastBreak = end;
+		while (lastBreak > begin && mData[lastBreak - 1] != '\n')
+			--lastBreak;
+
+		const char *ptr = mData + begin, *fastEnd = mData + lastBreak, *last = mData + end;
+		while (ptr < last) {
+			point_t point;
+			if (ptr < fastEnd && parseLineFast(ptr, point))
+				out(point);
+			else
+				ptr = mData + parseLine((std::size_t)(ptr - mData), end, out);
+		}
+	}
+
+	/*
+	 * \brief Skip the first line if it is a header, i.e., none of its fields starts like a number
+	 *		(e.g., "x,y"). Other lines are left to the parser, so a malformed first point is reported.
+	 */
+	std::size_t skipHeader() const
+	{
+		const char *lineEnd = (const char*)std::memchr(mData, '\n', mSize);
+		std::size_t length = lineEnd ? (std::size_t)(lineEnd - mData) : mSize;
+		std::size_t fields = 0;
+		for (std::size_t i = 0; i < length; ++i) {
+			if (isDelimiter(mData[i]) || (i > 0 && !isDelimiter(mData[i - 1])))
+				continue;
+			if (isDigit(mData[i]) || isSign(mData[i]))
+				return 0;
+			++fields;
+		}
+		return (fields == 0) ? 0 : (lineEnd ? length + 1 : mSize);
+	}
+
+public:
+	/*
+	 * \param fileName Name of the file (for error messages).
+	 * \param data Contents of the entire file.
+	 * \param size Size of the file in bytes.
+	 */
+	TextPointsParser(const std::string &fileName, const void *data, std::size_t size)
+		: mData((const char*)data), mSize(size), mFileName(fileName) {}
+
+	/*
+	 * \brief Upper bound of the number of points (lines without the header), the data are not parsed.
+	 */
+	std::size_t maxPoints() const
+	{
+		std::size_t begin = skipHeader();
+		return (begin < mSize) ? countLines(begin, mSize) : 0;
+	}
+
+	/*
+	 * \brief Parse the points, the data are split into chunks of whole lines parsed concurrently.
+	 * \param res Vector where the points are stored.
+	 * \param chunkSize Approximate size of one chunk in bytes.
+	 */
+	void parse(std::vector<point_t> &res, std::size_t chunkSize = 4*1024*1024) const
+	{
+		res.clear();
+		std::size_t begin = skipHeader();
+		if (std::thread::hardware_concurrency() <= 1) {
+			// No concurrency, the points are simply appended (which spares the counting of lines).
+			res.reserve((mSize - begin) / 16);
+			parseChunk(begin, mSize, [&](const point_t &point) { res.push_back(point); });
+			return;
+		}
+
+		// Chunk boundaries are moved right after the nearest following line break.
+		std::vector<std::size_t> bounds;
+		bounds.push_back(begin);
+		while (bounds.back() < mSize) {
+			std::size_t bound = std::min(bounds.back() + chunkSize, mSize);
+			const char *lineEnd = (const char*)std::memchr(mData + bound, '\n', mSize - bound);
+			bounds.push_back(lineEnd ? (std::size_t)(lineEnd - mData) + 1 : mSize);
+		}
+
+		// Every line holds at most one point, so the chunks are parsed directly into their parts of the result.
+		std::size_t chunks = bounds.size() - 1;
+		std::vector<std::size_t> offsets(chunks + 1, 0), counts(chunks);
+		run_tasks(chunks, [&](std::size_t i) {
+			offsets[i + 1] = countLines(bounds[i], bounds[i + 1]);
+		});
+		for (std::size_t i = 0; i < chunks; ++i)
+			offsets[i + 1] += offsets[i];
+
+		res.resize(offsets.back());
+		run_tasks(chunks, [&](std::size_t i) {
+			point_t *begin = res.data() + offsets[i], *out = begin;
+			parseChunk(bounds[i], bounds[i + 1], [&](const point_t &point) { *out++ = point; });
+			counts[i] = (std::size_t)(out - begin);
+		});
+
+		// Close the gaps left by empty lines.
+		std::size_t size = 0;
+		for (std::size_t i = 0; i < chunks; ++i) {
+			if (offsets[i] != size)
+				std::copy(res.begin() + offsets[i], res.begin() + offsets[i] + counts[i], res.begin() + size);
+			size += counts[i];
+		}
+		res.resize(size);
+	}
+};
+
+
+/*
+ * \brief Whether a points file should be parsed as text (detected by its extension).
+ */
+inline bool is_text_file(const std::string &fileName)
+{
+	for (const char *ext : { ".csv", ".txt", ".tsv" }) {
+		std::size_t len = std::strlen(ext);
+		if (fileName.length() > len && fileName.compare(fileName.length() - len, len, ext) == 0)
+			return true;
+	}
+	return false;
+}
+
+
+/*
+ * \brief Parse points from text data already in memory (e.g., a mapped file).
+ */
+inline void parse_text_points(const std::string &fileName, const void *data, std::size_t size, std::vector<point_t> &res)
+{
+	TextPointsParser(fileName, data, size).parse(res);
+}
+
+
+/*
+ * \brief Save points as text, one "x,y" line per point.
+ */
+inline void save_text_points(const std::string &fileName, array_view<const point_t> points)
+{
+	std::FILE *fp = std::fopen(fileName.c_str(), "w");
+	if (fp == nullptr)
+		throw (bpp::RuntimeError() << "File '" << fileName << "' cannot be opened for writing.");
+	bool ok = true;
+	for (std::size_t i = 0; i < points.size() && ok; ++i)
+		ok = std::fprintf(fp, "%lld,%lld\n", (long long)points[i].x, (long long)points[i].y) > 0;
+	ok = (std::fclose(fp) == 0) && ok;
+	if (!ok)
+		throw (bpp::RuntimeError() << "Error while writing data to file '" << fileName << "'.");
+}
+
+
+#endif
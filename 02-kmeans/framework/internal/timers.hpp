@@ -0,0 +1,242 @@
+#ifndef KMEANS_FRAMEWORK_INTERNAL_TIMERS_HPP
+#define KMEANS_FRAMEWORK_INTERNAL_TIMERS_HPP
+
+#include <exception.hpp>
+#include <perf_counters.hpp>
+#include <memory_usage.hpp>
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <ostream>
+#include <sstream>
+#include <iomanip>
+#include <cstdint>
+#include <cstddef>
+
+#include <time.h>
+
+
+/*
+ * \brief Hierarchical timers of the phases of a run. Phases are entered and left in a nested
+ *		manner (see ScopedTimer), a phase entered within another one becomes its child. Repeated
+ *		phases (e.g., one per iteration) keep all their samples. The clock is CLOCK_MONOTONIC.
+ * \note The timers are meant to be used by one (the main) thread, they wrap whole parallel regions.
+ */
+class PhaseTimers
+{
+private:
+	struct phase_t
+	{
+		std::string name;
+		std::size_t parent;
+		std::vector<double> samples;	///< Durations in milliseconds.
+		std::uint64_t start;
+		std::uint64_t startCounters[PerfCounters::COUNT];
+		std::uint64_t counters[PerfCounters::COUNT];	///< Sums of the counters over all samples.
+		std::uint64_t startAllocations, startAllocated;
+		std::uint64_t allocations, allocated;			///< Heap allocations (count and bytes) over all samples.
+	};
+
+	static const std::size_t NONE = ~(std::size_t)0;
+
+	std::vector<phase_t> mPhases;
+	std::vector<std::size_t> mStack;	///< Currently entered phases.
+	const PerfCounters *mCounters = nullptr;
+
+	static std::uint64_t now()
+	{
+		struct timespec ts;
+		::clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (std::uint64_t)ts.tv_sec * 1000000000ULL + (std::uint64_t)ts.tv_nsec;
+	}
+
+	std::string path(std::size_t phase) const
+	{
+		std::string res = mPhases[phase].name;
+		for (std::size_t p = mPhases[phase].parent; p != NONE; p = mPhases[p].parent)
+			res = mPhases[p].name + "/" + res;
+		return res;
+	}
+
+public:
+	/*
+	 * \brief Also measure given hardware counters in every phase (null turns them off).
+	 */
+	void setCounters(const PerfCounters *counters)
+	{
+		mCounters = counters;
+	}
+
+	/*
+	 * \brief Start a phase as a child of the current one (the phases are identified by their paths).
+	 */
+	void enter(const char *name)
+	{
+		std::size_t parent = mStack.empty() ? NONE : mStack.back();
+		std::size_t phase = 0;
+		while (phase < mPhases.size() && (mPhases[phase].parent != parent || mPhases[phase].name != name))
+			++phase;
+		if (phase == mPhases.size()) {
+			mPhases.emplace_back();
+			mPhases.back().name = name;
+			mPhases.back().parent = parent;
+			std::fill(mPhases.back().counters, mPhases.back().counters + PerfCounters::COUNT, 0);
+			mPhases.back().allocations = mPhases.back().allocated = 0;
+		}
+
+		mStack.push_back(phase);
+		if (mCounters)
+			mCounters->read(mPhases[phase].startCounters);
+		mPhases[phase].startAllocations = allocation_counters().allocations.load();
+		mPhases[phase].startAllocated = allocation_counters().allocated.load();
+		mPhases[phase].start = now();
+	}
+
+	/*
+	 * \brief Stop the current phase and record its duration.
+	 */
+	void leave()
+	{
+		if (!tryLeave())
+			throw bpp::RuntimeError("No timed phase to leave.");
+	}
+
+	/*
+	 * \brief Stop the current phase if there is any (for destructors, which must not throw).
+	 * \return Whether a phase was stopped.
+	 */
+	bool tryLeave()
+	{
+		if (mStack.empty())
+			return false;
+		phase_t &phase = mPhases[mStack.back()];
+		phase.samples.push_back((double)(now() - phase.start) * 1e-6);
+		phase.allocations += allocation_counters().allocations.load() - phase.startAllocations;
+		phase.allocated += allocation_counters().allocated.load() - phase.startAllocated;
+		if (mCounters) {
+			std::uint64_t values[PerfCounters::COUNT];
+			mCounters->read(values);
+			for (std::size_t i = 0; i < PerfCounters::COUNT; ++i)
+				phase.counters[i] += values[i] - phase.startCounters[i];
+		}
+		mStack.pop_back();
+		return true;
+	}
+
+	/*
+	 * \brief Durations (in ms) of all samples of a phase given by its path (empty if it was not entered).
+	 */
+	std::vector<double> samples(const std::string &phasePath) const
+	{
+		for (std::size_t i = 0; i < mPhases.size(); ++i)
+			if (path(i) == phasePath)
+				return mPhases[i].samples;
+		return std::vector<double>();
+	}
+
+	/*
+	 * \brief Write the summary as JSON: one record per phase (in the order of first entering) with
+	 *		its path, number of samples, total, minimal and maximal duration, all the samples,
+	 *		heap allocations (count and bytes) and sums of the available hardware counters.
+	 */
+	void writeJson(std::ostream &out) const
+	{
+		out << "{\"unit\":\"ms\",\"phases\":[";
+		for (std::size_t i = 0; i < mPhases.size(); ++i) {
+			const std::vector<double> &samples = mPhases[i].samples;
+			double total = 0.0;
+			for (double sample : samples) total += sample;
+
+			out << (i ? ",\n" : "\n") << "{\"path\":\"" << path(i) << "\",\"count\":" << samples.size()
+				<< ",\"total\":" << total;
+			if (!samples.empty())
+				out << ",\"min\":" << *std::min_element(samples.begin(), samples.end())
+					<< ",\"max\":" << *std::max_element(samples.begin(), samples.end());
+			out << ",\"samples\":[";
+			for (std::size_t s = 0; s < samples.size(); ++s)
+				out << (s ? "," : "") << samples[s];
+			out << "],\"allocations\":" << mPhases[i].allocations << ",\"allocated\":" << mPhases[i].allocated;
+			if (mCounters && mCounters->available()) {
+				out << ",\"counters\":{";
+				const char *separator = "";
+				for (std::size_t c = 0; c < PerfCounters::COUNT; ++c) {
+					if (!mCounters->available(c)) continue;
+					out << separator << "\"" << PerfCounters::name(c) << "\":" << mPhases[i].counters[c];
+					separator = ",";
+				}
+				out << "}";
+			}
+			out << "}";
+		}
+		out << "\n]}\n";
+	}
+
+	/*
+	 * \brief Write a table of heap allocations of the phases (count and megabytes, over all samples).
+	 */
+	void writeAllocations(std::ostream &out) const
+	{
+		out << "phase\tallocations\tallocated MB" << std::endl;
+		for (std::size_t i = 0; i < mPhases.size(); ++i)
+			out << path(i) << "\t" << mPhases[i].allocations << "\t" << (double)mPhases[i].allocated / (1024.0*1024.0) << std::endl;
+	}
+
+	/*
+	 * \brief Write a table of the hardware counters of the phases: cycles, instructions, IPC
+	 *		and LLC and branch misses per point and pass of the phase (unavailable counters
+	 *		are reported as n/a).
+	 * \param points Number of points processed in each pass of the phases.
+	 */
+	void writeCounters(std::ostream &out, std::size_t points) const
+	{
+		if (!mCounters || !mCounters->available())
+			return;
+
+		out << "phase\tcycles\tinstructions\tIPC\tLLC misses/point\tbranch misses/point" << std::endl;
+		for (std::size_t i = 0; i < mPhases.size(); ++i) {
+			const std::uint64_t *counters = mPhases[i].counters;
+
+			// Value of a counter divided by given divisor (n/a if the counter is not available).
+			auto value = [&](std::size_t counter, double divisor, int precision) -> std::string {
+				if (!mCounters->available(counter) || divisor <= 0.0)
+					return "n/a";
+				std::ostringstream str;
+				str << std::fixed << std::setprecision(precision) << (double)counters[counter] / divisor;
+				return str.str();
+			};
+
+			double pointPasses = (double)points * (double)mPhases[i].samples.size();
+			std::string ipc = mCounters->available(0) ? value(1, (double)counters[0], 3) : "n/a";
+			out << path(i) << "\t" << value(0, 1.0, 0) << "\t" << value(1, 1.0, 0) << "\t" << ipc
+				<< "\t" << value(2, pointPasses, 3) << "\t" << value(3, pointPasses, 3) << std::endl;
+		}
+	}
+};
+
+
+/*
+ * \brief Times a phase for the duration of a scope. Nothing is measured if the timers are null.
+ */
+class ScopedTimer
+{
+private:
+	PhaseTimers *mTimers;
+
+public:
+	ScopedTimer(PhaseTimers *timers, const char *name) : mTimers(timers)
+	{
+		if (mTimers) mTimers->enter(name);
+	}
+
+	ScopedTimer(const ScopedTimer&) = delete;
+	ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+	~ScopedTimer()
+	{
+		if (mTimers) mTimers->tryLeave();
+	}
+};
+
+
+#endif
@@ -0,0 +1,355 @@
+#ifndef KMEANS_FRAMEWORK_INTERNAL_URING_IO_HPP
+#define KMEANS_FRAMEWORK_INTERNAL_URING_IO_HPP
+
+#include <interface.hpp>
+#include <exception.hpp>
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <algorithm>
+#include <exception>
+#include <iostream>
+#include <new>
+#include <cstring>
+#include <cstdlib>
+#include <cstddef>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+
+/*
+ * \brief Asynchronous file I/O based on io_uring (raw system calls, no liburing needed).
+ *		The file is transferred in blocks, several of which are queued in the kernel at once.
+ *		Only readv/writev operations are used, so any kernel with io_uring (5.1+) suffices.
+ */
+class UringIO
+{
+private:
+	static const std::size_t ALIGNMENT = 4096;	///< Alignment of buffers and offsets for O_DIRECT.
+
+	struct FreeDeleter
+	{
+		void operator()(char *ptr) const { std::free(ptr); }
+	};
+
+	/*
+	 * \brief One queued operation (a block of the file).
+	 */
+	struct Slot
+	{
+		std::size_t offset;		///< Offset of the block in the file.
+		std::size_t useful;		///< Number of bytes of the block that belong to the data.
+		std::size_t length;		///< Number of bytes requested from the kernel (padded for O_DIRECT).
+		std::size_t done;		///< Number of bytes already transferred.
+		char *buffer;			///< Buffer used by the kernel (data itself or aligned bounce buffer).
+		std::unique_ptr<char, FreeDeleter> bounce;	///< Aligned bounce buffer (only for O_DIRECT).
+		struct iovec iov;
+	};
+
+	int mRingFd;
+	unsigned mEntries;
+	std::size_t mBlockSize;
+
+	void *mSqRing, *mCqRing;
+	std::size_t mSqRingSize, mCqRingSize;
+	struct io_uring_sqe *mSqes;
+	std::size_t mSqesSize;
+
+	unsigned *mSqHead, *mSqTail, *mSqMask, *mSqArray;
+	unsigned *mCqHead, *mCqTail, *mCqMask;
+	struct io_uring_cqe *mCqes;
+
+
+	static int setup(unsigned entries, struct io_uring_params *params)
+	{
+		return (int)::syscall(__NR_io_uring_setup, entries, params);
+	}
+
+	int enter(unsigned toSubmit, unsigned minComplete)
+	{
+		return (int)::syscall(__NR_io_uring_enter, mRingFd, toSubmit, minComplete, IORING_ENTER_GETEVENTS, nullptr, 0);
+	}
+
+	void release()
+	{
+		if (mSqes != nullptr && mSqes != MAP_FAILED) ::munmap(mSqes, mSqesSize);
+		if (mCqRing != nullptr && mCqRing != MAP_FAILED && mCqRing != mSqRing) ::munmap(mCqRing, mCqRingSize);
+		if (mSqRing != nullptr && mSqRing != MAP_FAILED) ::munmap(mSqRing, mSqRingSize);
+		if (mRingFd >= 0) ::close(mRingFd);
+	}
+
+	/*
+	 * \brief Put a readv/writev request for the rest of the slot into the submission queue.
+	 */
+	void queue(Slot &slot, std::size_t idx, int fd, bool write)
+	{
+		slot.iov.iov_base = slot.buffer + slot.done;
+		slot.iov.iov_len = slot.length - slot.done;
+
+		unsigned tail = *mSqTail;
+		unsigned index = tail & *mSqMask;
+		struct io_uring_sqe &sqe = mSqes[index];
+		std::memset(&sqe, 0, sizeof(sqe));
+		sqe.opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+		sqe.fd = fd;
+		sqe.off = slot.offset + slot.done;
+		sqe.addr = (unsigned long long)&slot.iov;
+		sqe.len = 1;
+		sqe.user_data = idx;
+		mSqArray[index] = index;
+		__atomic_store_n(mSqTail, tail + 1, __ATOMIC_RELEASE);
+	}
+
+
+public:
+	/*
+	 * \brief Check whether io_uring can be used (it may be missing or forbidden, e.g., in containers).
+	 */
+	static bool available()
+	{
+		struct io_uring_params params;
+		std::memset(&params, 0, sizeof(params));
+		int fd = setup(1, &params);
+		if (fd < 0) return false;
+		::close(fd);
+		return true;
+	}
+
+
+	/*
+	 * \param entries Number of operations kept in flight.
+	 * \param blockSize Size of one operation in bytes (multiple of ALIGNMENT).
+	 */
+	UringIO(unsigned entries = 8, std::size_t blockSize = 1024*1024)
+		: mRingFd(-1), mEntries(entries), mBlockSize(blockSize),
+		mSqRing(nullptr), mCqRing(nullptr), mSqRingSize(0), mCqRingSize(0), mSqes(nullptr), mSqesSize(0)
+	{
+		struct io_uring_params params;
+		std::memset(&params, 0, sizeof(params));
+		mRingFd = setup(entries, &params);
+		if (mRingFd < 0)
+			throw bpp::RuntimeError("The io_uring interface is not available.");
+		mEntries = std::min(params.sq_entries, params.cq_entries);
+
+		mSqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		mCqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+		if (params.features & IORING_FEAT_SINGLE_MMAP)
+			mSqRingSize = mCqRingSize = std::max(mSqRingSize, mCqRingSize);
+		mSqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+		mSqRing = ::mmap(nullptr, mSqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mRingFd, IORING_OFF_SQ_RING);
+		mCqRing = (params.features & IORING_FEAT_SINGLE_MMAP) ? mSqRing
+			: ::mmap(nullptr, mCqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mRingFd, IORING_OFF_CQ_RING);
+		mSqes = (struct io_uring_sqe*)::mmap(nullptr, mSqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mRingFd, IORING_OFF_SQES);
+		if (mSqRing == MAP_FAILED || mCqRing == MAP_FAILED || mSqes == MAP_FAILED) {
+			release();
+			throw bpp::RuntimeError("The io_uring queues cannot be mapped.");
+		}
+
+		char *sq = (char*)mSqRing;
+		mSqHead = (unsigned*)(sq + params.sq_off.head);
+		mSqTail = (unsigned*)(sq + params.sq_off.tail);
+		mSqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+		mSqArray = (unsigned*)(sq + params.sq_off.array);
+
+		char *cq = (char*)mCqRing;
+		mCqHead = (unsigned*)(cq + params.cq_off.head);
+		mCqTail = (unsigned*)(cq + params.cq_off.tail);
+		mCqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+		mCqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+	}
+
+	UringIO(const UringIO&) = delete;
+	UringIO& operator=(const UringIO&) = delete;
+
+	~UringIO()
+	{
+		release();
+	}
+
+
+	/*
+	 * \brief Read or write an entire buffer from/to the beginning of an open file.
+	 * \param fd File descriptor.
+	 * \param write True for writing, false for reading.
+	 * \param data The buffer (need not be aligned).
+	 * \param size Size of the buffer in bytes.
+	 * \param direct Whether the file was opened with O_DIRECT (aligned bounce buffers are used).
+	 * \return Number of bytes actually transferred to the file (padded when direct writing).
+	 */
+	std::size_t transfer(int fd, bool write, char *data, std::size_t size, bool direct)
+	{
+		std::vector<Slot> slots(mEntries);
+		if (direct) {
+			for (auto &slot : slots) {
+				void *ptr = nullptr;
+				if (::posix_memalign(&ptr, ALIGNMENT, mBlockSize) != 0)
+					throw std::bad_alloc();
+				slot.bounce.reset((char*)ptr);
+			}
+		}
+
+		std::size_t blocks = (size + mBlockSize - 1) / mBlockSize;
+		std::size_t nextBlock = 0, inFlight = 0, transferred = 0;
+		unsigned toSubmit = 0;
+		int error = 0;
+
+		// Prepare the slot for the next block of the file and queue it.
+		auto start = [&](std::size_t idx) {
+			Slot &slot = slots[idx];
+			slot.offset = nextBlock++ * mBlockSize;
+			slot.useful = std::min(mBlockSize, size - slot.offset);
+			slot.length = direct ? (slot.useful + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT : slot.useful;
+			slot.done = 0;
+			slot.buffer = direct ? slot.bounce.get() : data + slot.offset;
+			if (direct && write) {
+				std::memcpy(slot.buffer, data + slot.offset, slot.useful);
+				std::memset(slot.buffer + slot.useful, 0, slot.length - slot.useful);
+			}
+			queue(slot, idx, fd, write);
+			++toSubmit;
+			++inFlight;
+		};
+
+		for (std::size_t i = 0; i < slots.size() && nextBlock < blocks; ++i)
+			start(i);
+
+		// The loop ends only when no request is in flight, since the kernel may still access the slots,
+		// their buffers and the data. When an error occurs, the rest of the requests is just reaped.
+		while (inFlight > 0) {
+			int res = enter(toSubmit, 1);
+			if (res < 0 && errno != EINTR) {
+				if (toSubmit == 0) {
+					// Waiting for the submitted requests failed, they cannot be safely abandoned.
+					std::cerr << "The io_uring_enter call failed (" << std::strerror(errno) << ") with requests in flight." << std::endl;
+					std::terminate();
+				}
+				if (error == 0)
+					error = errno;
+
+				// Take back the requests the kernel has not consumed and wait only for the submitted ones.
+				unsigned head = __atomic_load_n(mSqHead, __ATOMIC_ACQUIRE);
+				inFlight -= *mSqTail - head;
+				__atomic_store_n(mSqTail, head, __ATOMIC_RELEASE);
+				toSubmit = 0;
+				continue;
+			}
+			if (res > 0) toSubmit -= std::min<unsigned>(toSubmit, (unsigned)res);
+
+			unsigned head = *mCqHead;
+			unsigned tail = __atomic_load_n(mCqTail, __ATOMIC_ACQUIRE);
+			for (; head != tail; ++head) {
+				const struct io_uring_cqe &cqe = mCqes[head & *mCqMask];
+				std::size_t idx = (std::size_t)cqe.user_data;
+				Slot &slot = slots[idx];
+
+				if (cqe.res < 0 && (cqe.res == -EINTR || cqe.res == -EAGAIN) && error == 0) {
+					queue(slot, idx, fd, write);
+					++toSubmit;
+					continue;
+				}
+
+				if (cqe.res < 0)
+					error = -cqe.res;
+				else if (cqe.res == 0 && slot.done < slot.useful)
+					error = EIO;	// Unexpected end of file.
+				else
+					slot.done += (std::size_t)cqe.res;
+
+				if (error == 0 && slot.done < (write ? slot.length : slot.useful)) {
+					queue(slot, idx, fd, write);	// Short transfer, continue with the rest.
+					++toSubmit;
+					continue;
+				}
+
+				if (error == 0) {
+					if (direct && !write)
+						std::memcpy(data + slot.offset, slot.buffer, slot.useful);
+					transferred += write ? slot.length : slot.useful;
+				}
+
+				--inFlight;
+				if (error == 0 && nextBlock < blocks)
+					start(idx);
+			}
+			__atomic_store_n(mCqHead, head, __ATOMIC_RELEASE);
+		}
+
+		if (error != 0)
+			throw (bpp::RuntimeError() << "Asynchronous " << (write ? "write" : "read") << " failed (" << std::strerror(error) << ").");
+		return transferred;
+	}
+};
+
+
+/*
+ * \brief Open a file for io_uring transfers, O_DIRECT is dropped if the file system does not support it.
+ */
+inline int open_file_uring(const std::string &fileName, bool write, bool &direct)
+{
+	int flags = write ? (O_WRONLY | O_CREAT | O_TRUNC) : O_RDONLY;
+	int fd = direct ? ::open(fileName.c_str(), flags | O_DIRECT, 0644) : -1;
+	if (fd < 0) {
+		direct = false;
+		fd = ::open(fileName.c_str(), flags, 0644);
+	}
+	if (fd < 0)
+		throw (bpp::RuntimeError() << "File '" << fileName << "' cannot be opened for " << (write ? "writing." : "reading."));
+	return fd;
+}
+
+
+/*
+ * \brief Load an entire file into a vector of records using io_uring.
+ */
+template<typename T>
+void load_file_uring(const std::string &fileName, std::vector<T> &res, bool direct)
+{
+	int fd = open_file_uring(fileName, false, direct);
+	try {
+		struct stat st;
+		if (::fstat(fd, &st) != 0)
+			throw (bpp::RuntimeError() << "Cannot determine size of file '" << fileName << "'.");
+		res.resize((std::size_t)st.st_size / sizeof(T));
+
+		UringIO ring;
+		ring.transfer(fd, false, (char*)res.data(), res.size() * sizeof(T), direct);
+	}
+	catch (std::exception &e) {
+		::close(fd);
+		throw (bpp::RuntimeError() << "Error while reading from file '" << fileName << "': " << e.what());
+	}
+	::close(fd);
+}
+
+
+/*
+ * \brief Save an array of records into a file using io_uring.
+ */
+template<typename T>
+void save_file_uring(const std::string &fileName, array_view<const T> data, bool direct)
+{
+	int fd = open_file_uring(fileName, true, direct);
+	try {
+		std::size_t size = data.size() * sizeof(T);
+		UringIO ring;
+		if (ring.transfer(fd, true, (char*)data.data(), size, direct) != size && ::ftruncate(fd, (off_t)size) != 0)
+			throw bpp::RuntimeError("Cannot truncate the padding.");
+	}
+	catch (std::exception &e) {
+		::close(fd);
+		throw (bpp::RuntimeError() << "Error while writing data to file '" << fileName << "': " << e.what());
+	}
+	::close(fd);
+}
+
+
+#endif
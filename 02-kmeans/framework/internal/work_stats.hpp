@@ -0,0 +1,182 @@
+#ifndef KMEANS_FRAMEWORK_INTERNAL_WORK_STATS_HPP
+#define KMEANS_FRAMEWORK_INTERNAL_WORK_STATS_HPP
+
+#include <exception.hpp>
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <ostream>
+#include <cstdint>
+#include <cstddef>
+
+#include <time.h>
+
+
+/*
+ * \brief Per-thread work counters of parallel loops: processed items, executed chunks (and how
+ *		many of them were stolen, i.e., executed by a thread other than the one which started
+ *		the loop), time spent in the chunks (busy) and the rest of the wall time of the loops (wait).
+ *		Every thread updates only its own counters, so no synchronization is needed while the
+ *		loops run (a thread takes a lock only once to register itself).
+ * \note Only leaf task bodies should be recorded, otherwise the busy time of nested chunks is counted twice.
+ */
+class WorkStats
+{
+public:
+	static constexpr std::size_t MAX_LOOPS = 8;
+
+private:
+	struct counters_t
+	{
+		std::uint64_t items = 0;
+		std::uint64_t chunks = 0;
+		std::uint64_t stolen = 0;
+		std::uint64_t busy = 0;		///< In nanoseconds.
+	};
+
+	struct thread_counters_t
+	{
+		counters_t loops[MAX_LOOPS];
+	};
+
+	std::uint64_t mId;
+	std::mutex mMutex;
+	std::vector<std::unique_ptr<thread_counters_t>> mThreads;
+	std::vector<std::string> mLoops;
+	std::vector<std::uint64_t> mWallTimes;	///< Total wall time of each loop (in ns).
+	std::size_t mLoop = 0;					///< Currently running loop.
+	std::uint64_t mLoopStart = 0;
+	const thread_counters_t *mOwner = nullptr;	///< Thread which started the current loop.
+
+	thread_counters_t& local()
+	{
+		thread_local std::uint64_t cachedId = 0;
+		thread_local thread_counters_t *cachedCounters = nullptr;
+		if (cachedId != mId) {
+			std::lock_guard<std::mutex> lock(mMutex);
+			mThreads.emplace_back(new thread_counters_t());
+			cachedCounters = mThreads.back().get();
+			cachedId = mId;
+		}
+		return *cachedCounters;
+	}
+
+public:
+	WorkStats()
+	{
+		static std::atomic<std::uint64_t> lastId(0);
+		mId = ++lastId;
+	}
+
+	WorkStats(const WorkStats&) = delete;
+	WorkStats& operator=(const WorkStats&) = delete;
+
+	static std::uint64_t now()
+	{
+		struct timespec ts;
+		::clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (std::uint64_t)ts.tv_sec * 1000000000ULL + (std::uint64_t)ts.tv_nsec;
+	}
+
+	/*
+	 * \brief Start a parallel loop (called by the thread which runs the loop, before it).
+	 *		Repeated runs of a loop with the same name are accumulated.
+	 */
+	void begin(const char *loop)
+	{
+		mLoop = std::find(mLoops.begin(), mLoops.end(), loop) - mLoops.begin();
+		if (mLoop == mLoops.size()) {
+			if (mLoops.size() == MAX_LOOPS)
+				throw (bpp::RuntimeError() << "Too many loops in work statistics (at most " << MAX_LOOPS << ").");
+			mLoops.push_back(loop);
+			mWallTimes.push_back(0);
+		}
+		mOwner = &local();
+		mLoopStart = now();
+	}
+
+	/*
+	 * \brief Finish the current loop (after all its chunks have been executed).
+	 */
+	void end()
+	{
+		mWallTimes[mLoop] += now() - mLoopStart;
+	}
+
+	/*
+	 * \brief Record one chunk of the current loop executed by the calling thread.
+	 * \param items Number of items processed by the chunk.
+	 * \param start Time (now()) when the chunk started.
+	 */
+	void record(std::uint64_t items, std::uint64_t start)
+	{
+		thread_counters_t &thread = local();
+		counters_t &counters = thread.loops[mLoop];
+		counters.items += items;
+		++counters.chunks;
+		if (&thread != mOwner)
+			++counters.stolen;
+		counters.busy += now() - start;
+	}
+
+	/*
+	 * \brief Print the counters of every thread in every loop and the imbalance ratios
+	 *		(maximum divided by mean over the threads) of the busy time and of the items.
+	 */
+	void writeSummary(std::ostream &out)
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		for (std::size_t loop = 0; loop < mLoops.size(); ++loop) {
+			double wall = (double)mWallTimes[loop] * 1e-6;
+			out << mLoops[loop] << ": " << wall << " ms, " << mThreads.size() << " threads" << std::endl;
+
+			double busySum = 0.0, busyMax = 0.0, itemsSum = 0.0, itemsMax = 0.0;
+			for (std::size_t t = 0; t < mThreads.size(); ++t) {
+				const counters_t &counters = mThreads[t]->loops[loop];
+				double busy = (double)counters.busy * 1e-6;
+				out << "  thread " << t << ": " << counters.items << " items, " << counters.chunks << " chunks ("
+					<< counters.stolen << " stolen), busy " << busy << " ms, wait " << std::max(wall - busy, 0.0) << " ms" << std::endl;
+				busySum += busy;
+				busyMax = std::max(busyMax, busy);
+				itemsSum += (double)counters.items;
+				itemsMax = std::max(itemsMax, (double)counters.items);
+			}
+
+			double threads = (double)std::max<std::size_t>(mThreads.size(), 1);
+			out << "  imbalance: busy " << (busySum > 0.0 ? busyMax * threads / busySum : 1.0)
+				<< ", items " << (itemsSum > 0.0 ? itemsMax * threads / itemsSum : 1.0)
+				<< ", utilization " << (wall > 0.0 ? busySum / (wall * threads) * 100.0 : 0.0) << " %" << std::endl;
+		}
+	}
+};
+
+
+/*
+ * \brief Records one chunk of a parallel loop for the duration of a scope (nothing if the statistics are null).
+ */
+class WorkScope
+{
+private:
+	WorkStats *mStats;
+	std::uint64_t mItems;
+	std::uint64_t mStart;
+
+public:
+	WorkScope(WorkStats *stats, std::uint64_t items)
+		: mStats(stats), mItems(items), mStart(stats ? WorkStats::now() : 0) {}
+
+	WorkScope(const WorkScope&) = delete;
+	WorkScope& operator=(const WorkScope&) = delete;
+
+	~WorkScope()
+	{
+		if (mStats) mStats->record(mItems, mStart);
+	}
+};
+
+
+#endif
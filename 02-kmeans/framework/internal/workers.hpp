@@ -0,0 +1,55 @@
+#ifndef KMEANS_FRAMEWORK_INTERNAL_WORKERS_HPP
+#define KMEANS_FRAMEWORK_INTERNAL_WORKERS_HPP
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <exception>
+#include <cstddef>
+
+
+/*
+ * \brief Run tasks 0 .. count-1 on a group of worker threads, the tasks are picked up dynamically.
+ *		The first exception thrown by a task stops the remaining ones and is rethrown.
+ * \note Plain threads are used since this code is shared with the serial build (no TBB there).
+ * \param count Number of tasks.
+ * \param task Functor invoked with the task index.
+ * \param threads Maximal number of workers (0 = hardware concurrency).
+ */
+template<typename F>
+void run_tasks(std::size_t count, F task, std::size_t threads = 0)
+{
+	if (threads == 0)
+		threads = std::max<std::size_t>(std::thread::hardware_concurrency(), 1);
+
+	std::atomic<std::size_t> next(0);
+	std::atomic<bool> failed(false);
+	std::exception_ptr error;
+
+	auto worker = [&]() {
+		try {
+			std::size_t idx;
+			while (!failed && (idx = next++) < count)
+				task(idx);
+		}
+		catch (...) {
+			if (!failed.exchange(true))
+				error = std::current_exception();
+		}
+	};
+
+	std::vector<std::thread> workers;
+	threads = std::min(threads, count);
+	for (std::size_t i = 1; i < threads; ++i)
+		workers.emplace_back(worker);
+	worker();
+	for (auto &w : workers)
+		w.join();
+
+	if (error)
+		std::rethrow_exception(error);
+}
+
+
+#endif
@@ -4,12 +4,36 @@
  */
 #include <implementation.hpp>
 
+// Out-of-core engine is available only in builds that provide it (not in the serial one).
+#if __has_include(<out_of_core.hpp>)
+	#include <out_of_core.hpp>
+	#define KMEANS_OUT_OF_CORE
+#endif
+
 #include <exception.hpp>
 #include <stopwatch.hpp>
+#include <timers.hpp>
+#include <perf_counters.hpp>
+#include <task_trace.hpp>
+#include <roofline.hpp>
+#include <work_stats.hpp>
+#include <memory_usage.hpp>
 #include <interface.hpp>
+#include <mapped_file.hpp>
+#include <parallel_io.hpp>
+#include <uring_io.hpp>
+#include <dataset.hpp>
+#include <compressed.hpp>
+#include <columnar.hpp>
+#include <text_points.hpp>
+#include <shards.hpp>
+#include <stream_input.hpp>
+#include <cluster_index.hpp>
 
 #include <vector>
+#include <memory>
 #include <iostream>
+#include <fstream>
 #include <string>
 #include <algorithm>
 #include <cstdint>
@@ -17,15 +41,71 @@
 
 
 
+/*
+ * Global operators new and delete are replaced so that all heap allocations are counted
+ * (once the counting is enabled in main). The array and sized variants forward to these ones.
+ */
+void* operator new(std::size_t size)
+{
+	return counted_malloc(size);
+}
+
+void operator delete(void *ptr) noexcept
+{
+	counted_free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept
+{
+	counted_free(ptr);
+}
+
+
 void print_usage()
 {
-	std::cout << "Arguments: [ -debug ] <points_file> <k> <iters> <centroids_file> <assignments_file>" << std::endl;
+	std::cout << "Arguments: [ options ] <points_file> <k> <iters> <centroids_file> <assignments_file>" << std::endl;
 	std::cout << "  -debug             - flag for debugging output" << std::endl;
-	std::cout << "  <points_file>      - input file containing point coordinates" << std::endl;
+	std::cout << "  -ooc[=<points>]    - stream the points file in chunks (out-of-core), optionally set chunk size" << std::endl;
+	std::cout << "  -mmap              - map the points file into memory instead of loading it" << std::endl;
+	std::cout << "  -mmap-out          - map the output files, the results are stored into them directly" << std::endl;
+	std::cout << "                       (through <file>.part, which replaces the file when the run succeeds)" << std::endl;
+	std::cout << "  -io=<backend>      - file I/O backend: stdio (default), pread (concurrent ranges)" << std::endl;
+	std::cout << "                       or uring (asynchronous io_uring, falls back to stdio if unavailable)" << std::endl;
+	std::cout << "                       (dataset and compressed inputs are then read whole and decoded in memory)" << std::endl;
+	std::cout << "  -direct            - bypass the page cache (O_DIRECT) with the uring backend" << std::endl;
+	std::cout << "  -timing            - report load and save times separately from the computation" << std::endl;
+	std::cout << "  -timers=<file>     - save durations of the phases (load, init, compute with the assign, reduce" << std::endl;
+	std::cout << "                       and update phases of every iteration, save) as JSON" << std::endl;
+	std::cout << "  -perf              - measure hardware counters (cycles, instructions, LLC and branch misses) in the" << std::endl;
+	std::cout << "                       phases and report IPC and misses per point (skipped if the counters are not available)" << std::endl;
+	std::cout << "  -roofline          - report achieved bandwidth (GB/s) and distance throughput (Gdist/s) of every iteration against the roofline" << std::endl;
+	std::cout << "                       and the percentage of the peak bandwidth measured by a STREAM-like triad" << std::endl;
+	std::cout << "  -workers           - report work of every thread in the parallel loops (items, chunks, stolen chunks," << std::endl;
+	std::cout << "                       busy and wait time) and the imbalance ratios" << std::endl;
+	std::cout << "  -memory            - report peak RSS, heap allocations (in total and per phase) and the estimated memory" << std::endl;
+	std::cout << "  -memlimit=<size>   - fail before the computation if its estimated memory exceeds the limit" << std::endl;
+	std::cout << "                       (bytes, K, M or G suffix may be used)" << std::endl;
+	std::cout << "  -counters          - report distance evaluations, pruned candidates and skipped points of every iteration" << std::endl;
+	std::cout << "                       (only in builds with KMEANS_WORK_COUNTERS defined)" << std::endl;
+	std::cout << "  -trace=<file>      - save the timeline of the parallel tasks of the computation (on every worker" << std::endl;
+	std::cout << "                       thread) in the Chrome trace format (chrome://tracing or Perfetto)" << std::endl;
+	std::cout << "  -members=<file>    - also save points grouped by clusters: k+1 offsets and then indices of" << std::endl;
+	std::cout << "                       the points (all uint64), members of cluster c are at [offsets[c], offsets[c+1])" << std::endl;
+	std::cout << "  -sorted=<file>     - also save the points reordered by clusters (raw point_t records) and" << std::endl;
+	std::cout << "                       the permutation into <file>.perm (the same layout as the -members file)" << std::endl;
+	std::cout << "  -stats=<file>      - also save statistics of the clusters (size, SSE and bounding box) as CSV" << std::endl;
+	std::cout << "  -second=<file>     - also save margins (uint64 differences of squared distances to the second-nearest" << std::endl;
+	std::cout << "                       and the nearest centroid) of all points followed by their second-nearest clusters" << std::endl;
+	std::cout << "  -columns           - points are given as two column files <x_file>,<y_file> (raw coord_t arrays)" << std::endl;
+	std::cout << "  -text              - parse the points file as text (implied by .csv, .txt and .tsv extensions)" << std::endl;
+	std::cout << "  <points_file>      - input file containing point coordinates (raw, with dataset header, compressed or text)," << std::endl;
+	std::cout << "                       a comma-separated list of files and glob patterns (shards, unless such a file exists)," << std::endl;
+	std::cout << "                       or - to read the points from the standard input" << std::endl;
 	std::cout << "  <k>                - desired number of clusters (1-256)" << std::endl;
 	std::cout << "  <iters>            - number of refining iterations (1-1000)" << std::endl;
 	std::cout << "  <centroids_file>   - output file where final centroids are stored" << std::endl;
 	std::cout << "  <assignments_file> - output file where final assignment is stored" << std::endl;
+	std::cout << "                       (sharded input has one <assignments_file>.<i> file per shard)" << std::endl;
 }
 
 
@@ -40,6 +120,104 @@ std::size_t getNumArg(const std::string &str)
 }
 
 
+/*
+ * \brief Backends used for loading and saving files.
+ */
+enum class IOBackend { STDIO, PREAD, URING };
+
+
+/*
+ * \brief Optional settings given as leading arguments (starting with '-').
+ */
+struct Options
+{
+	bool debug = false;
+	bool outOfCore = false;
+	std::size_t chunkSize = 4*1024*1024;
+	bool mmap = false;
+	IOBackend io = IOBackend::STDIO;
+	bool direct = false;
+	bool timing = false;
+	bool columns = false;
+	bool text = false;
+	bool mmapOut = false;
+	std::string membersFile;
+	std::string sortedFile;
+	std::string statsFile;
+	std::string secondFile;
+	std::string timersFile;
+	bool perf = false;
+	bool roofline = false;
+	bool workers = false;
+	bool memory = false;
+	std::size_t memoryLimit = 0;
+	bool counters = false;
+	std::string traceFile;
+
+	/*
+	 * \brief Parse one option argument. False is returned if the option is not recognized.
+	 */
+	bool parse(const std::string &arg)
+	{
+		std::string name = arg.substr(0, arg.find('='));
+		std::string value = (name.length() < arg.length()) ? arg.substr(name.length() + 1) : std::string();
+
+		if (name == "-debug" && value.empty())
+			debug = true;
+		else if (name == "-mmap" && value.empty())
+			mmap = true;
+		else if (name == "-timing" && value.empty())
+			timing = true;
+		else if (name == "-columns" && value.empty())
+			columns = true;
+		else if (name == "-text" && value.empty())
+			text = true;
+		else if (name == "-mmap-out" && value.empty())
+			mmapOut = true;
+		else if (name == "-members" && !value.empty())
+			membersFile = value;
+		else if (name == "-sorted" && !value.empty())
+			sortedFile = value;
+		else if (name == "-stats" && !value.empty())
+			statsFile = value;
+		else if (name == "-second" && !value.empty())
+			secondFile = value;
+		else if (name == "-timers" && !value.empty())
+			timersFile = value;
+		else if (name == "-perf" && value.empty())
+			perf = true;
+		else if (name == "-roofline" && value.empty())
+			roofline = true;
+		else if (name == "-workers" && value.empty())
+			workers = true;
+		else if (name == "-memory" && value.empty())
+			memory = true;
+		else if (name == "-memlimit" && !value.empty())
+			memoryLimit = parse_memory_size(value);
+		else if (name == "-counters" && value.empty())
+			counters = true;
+		else if (name == "-trace" && !value.empty())
+			traceFile = value;
+		else if (name == "-io" && value == "stdio")
+			io = IOBackend::STDIO;
+		else if (name == "-io" && value == "pread")
+			io = IOBackend::PREAD;
+		else if (name == "-io" && value == "uring")
+			io = IOBackend::URING;
+		else if (name == "-direct" && value.empty())
+			direct = true;
+		else if (name == "-ooc") {
+			outOfCore = true;
+			if (!value.empty() && (chunkSize = getNumArg(value)) == 0)
+				return false;
+		}
+		else
+			return false;
+		return true;
+	}
+};
+
+
 /*
  * \bried Load an entire file into a vector of points.
  */
@@ -70,10 +248,10 @@ void load_file(const std::string &fileName, std::vector<point_t> &res)
 
 
 /*
-* \bried Load an entire file into a vector of points.
+* \bried Save an array of records into a file.
 */
 template<typename T>
-void save_file(const std::string &fileName, const std::vector<T> &data)
+void save_file(const std::string &fileName, array_view<const T> data)
 {
 	// Open the file.
 	std::FILE *fp = std::fopen(fileName.c_str(), "wb");
@@ -93,32 +271,402 @@ void save_file(const std::string &fileName, const std::vector<T> &data)
 }
 
 
+/*
+ * \brief Decode a dataset or compressed file using the selected I/O backend (pread or io_uring),
+ *		the entire file is read into memory first.
+ */
+void load_encoded_file(const Options &options, const std::string &fileName, std::vector<point_t> &res)
+{
+	std::vector<char> data;
+	if (options.io == IOBackend::URING)
+		load_file_uring(fileName, data, options.direct);
+	else
+		load_file_parallel(fileName, data);
+
+	if (is_compressed_file(fileName)) {
+		decode_compressed(fileName, data.data(), data.size(), res);
+		return;
+	}
+	std::vector<point_t> storage;
+	array_view<const point_t> points = dataset_points(fileName, data.data(), data.size(), storage);
+	if (points.data() == storage.data())
+		res.swap(storage);
+	else
+		res.assign(points.begin(), points.end());
+}
+
+
+/*
+ * \brief Load the points using the selected I/O backend.
+ */
+void load_points(const Options &options, const std::string &fileName, std::vector<point_t> &res)
+{
+	if (fileName == "-")
+		load_stream(stdin, "standard input", options.text, res);
+	else if (options.columns)
+		load_split_columns(fileName, res);
+	else if (options.text) {
+		MappedFile file(fileName);
+		parse_text_points(fileName, file.view<char>().data(), file.size(), res);
+	}
+	else if ((is_dataset_file(fileName) || is_compressed_file(fileName))
+		&& (options.io == IOBackend::PREAD || (options.io == IOBackend::URING && UringIO::available())))
+		load_encoded_file(options, fileName, res);
+	else if (is_dataset_file(fileName))
+		load_dataset(fileName, res);
+	else if (is_compressed_file(fileName)) {
+		MappedFile file(fileName);
+		decode_compressed(fileName, file.view<char>().data(), file.size(), res);
+	}
+	else if (options.io == IOBackend::PREAD)
+		load_file_parallel(fileName, res);
+	else if (options.io == IOBackend::URING && UringIO::available())
+		load_file_uring(fileName, res, options.direct);
+	else
+		load_file(fileName, res);
+}
+
+
+/*
+ * \brief Number of points in a file which can be read directly into a prepared place (raw points
+ *		and datasets), UNKNOWN_SHARD_SIZE if the file has to be parsed or decoded first.
+ */
+std::size_t count_points(const Options &options, const std::string &fileName)
+{
+	if (options.text || is_text_file(fileName) || is_compressed_file(fileName))
+		return UNKNOWN_SHARD_SIZE;
+	if (is_dataset_file(fileName))
+		return (std::size_t)read_dataset_header(fileName).count;
+	return ParallelIO(fileName, false).size() / sizeof(point_t);
+}
+
+
+/*
+ * \brief Read the points of a file into a prepared place (its size is given by count_points).
+ */
+void read_points(const std::string &fileName, array_view<point_t> res)
+{
+	if (is_dataset_file(fileName))
+		load_dataset(fileName, res);
+	else
+		read_file_parallel(fileName, res, 1);	// the files are already read concurrently
+}
+
+
+/*
+ * \brief Number of points in an input file determined without loading it (an upper bound for text,
+ *		whose lines are only counted), UNKNOWN_SHARD_SIZE if it cannot be determined (standard input).
+ */
+std::size_t input_points(const Options &options, const std::string &fileName)
+{
+	if (fileName == "-")
+		return UNKNOWN_SHARD_SIZE;
+	if (options.columns) {
+		std::string xFile, yFile;
+		split_column_files(fileName, xFile, yFile);
+		return ParallelIO(xFile, false).size() / sizeof(point_t::coord_t);
+	}
+	if (options.text || is_text_file(fileName) || is_compressed_file(fileName)) {
+		MappedFile file(fileName);
+		const char *data = file.view<char>().data();
+		return (options.text || is_text_file(fileName))
+			? TextPointsParser(fileName, data, file.size()).maxPoints()
+			: compressed_point_count(fileName, data, file.size());
+	}
+	return count_points(options, fileName);
+}
+
+
+/*
+ * \brief Whether the points are used in place of the mapped input file (see map_points), i.e., not loaded.
+ */
+bool input_in_place(const Options &options, const std::string &fileName)
+{
+	return options.mmap && !options.text && !is_compressed_file(fileName)
+		&& (!is_dataset_file(fileName) || read_dataset_header(fileName).native());
+}
+
+
+/*
+ * \brief Check the estimated memory of the computation against the limit (an error is printed if it is exceeded).
+ */
+bool check_memory_limit(const Options &options, std::size_t estimate)
+{
+	if (options.memoryLimit == 0 || estimate <= options.memoryLimit)
+		return true;
+	const double MB = 1024.0 * 1024.0;
+	std::cerr << "Error: The computation needs about " << (double)estimate / MB << " MB, which exceeds the memory limit of "
+		<< (double)options.memoryLimit / MB << " MB." << std::endl;
+	return false;
+}
+
+
+/*
+ * \brief Get the points from a mapped file, they are used in place unless conversion is necessary.
+ */
+array_view<const point_t> map_points(const Options &options, const std::string &fileName, const MappedFile &file,
+	std::vector<point_t> &storage)
+{
+	const char *data = file.view<char>().data();
+	if (options.text) {
+		parse_text_points(fileName, data, file.size(), storage);
+		return storage;
+	}
+	if (compressed_header_t::matches(data, file.size())) {
+		decode_compressed(fileName, data, file.size(), storage);
+		return storage;
+	}
+	return dataset_points(fileName, data, file.size(), storage);
+}
+
+
+/*
+ * \brief Save the results using the selected I/O backend.
+ */
+template<typename T>
+void save_results(const Options &options, const std::string &fileName, array_view<const T> data)
+{
+	if (options.io == IOBackend::PREAD)
+		save_file_parallel<T>(fileName, data);
+	else if (options.io == IOBackend::URING && UringIO::available())
+		save_file_uring<T>(fileName, data, options.direct);
+	else
+		save_file<T>(fileName, data);
+}
+
+
+
+/*
+ * \brief Build and save the cluster membership (CSR) file, i.e., k+1 offsets followed by the indices
+ *		of the points grouped by their clusters. The index is built directly in the mapped file with -mmap-out.
+ */
+void save_members(const Options &options, const std::string &fileName, std::size_t k, array_view<const std::uint8_t> assignments)
+{
+	std::size_t size = k + 1 + assignments.size();
+	std::unique_ptr<MappedOutputFile> file;
+	std::vector<std::uint64_t> buffer;
+	array_view<std::uint64_t> data;
+	if (options.mmapOut) {
+		file.reset(new MappedOutputFile(fileName, size * sizeof(std::uint64_t)));
+		data = file->view<std::uint64_t>();
+	}
+	else {
+		buffer.resize(size);
+		data = buffer;
+	}
+
+	build_cluster_index(assignments, k, array_view<std::uint64_t>(data.data(), k + 1),
+		array_view<std::uint64_t>(data.data() + k + 1, assignments.size()));
+
+	if (options.mmapOut)
+		file->commit();
+	else
+		save_results<std::uint64_t>(options, fileName, buffer);
+}
+
+
+
+/*
+ * \brief Save the points reordered by their clusters (stable, so the clusters keep the original order
+ *		of points) and the permutation (offsets of clusters and original indices of the points).
+ */
+void save_sorted(const Options &options, const std::string &fileName, std::size_t k,
+	array_view<const point_t> points, array_view<const std::uint8_t> assignments)
+{
+	std::string permFileName = fileName + ".perm";
+	std::size_t permSize = k + 1 + points.size();
+	std::unique_ptr<MappedOutputFile> pointsFile, permFile;
+	std::vector<point_t> pointsBuffer;
+	std::vector<std::uint64_t> permBuffer;
+	array_view<point_t> sorted;
+	array_view<std::uint64_t> perm;
+	if (options.mmapOut) {
+		pointsFile.reset(new MappedOutputFile(fileName, points.size() * sizeof(point_t)));
+		permFile.reset(new MappedOutputFile(permFileName, permSize * sizeof(std::uint64_t)));
+		sorted = pointsFile->view<point_t>();
+		perm = permFile->view<std::uint64_t>();
+	}
+	else {
+		pointsBuffer.resize(points.size());
+		permBuffer.resize(permSize);
+		sorted = pointsBuffer;
+		perm = permBuffer;
+	}
+
+	ClusterSort<std::uint8_t> sort(assignments, k, array_view<std::uint64_t>(perm.data(), k + 1));
+	std::uint64_t *indices = perm.data() + k + 1;
+	sort.scatter([&](std::size_t position, std::size_t point) {
+		sorted[position] = points[point];
+		indices[position] = (std::uint64_t)point;
+	});
+
+	if (options.mmapOut) {
+		pointsFile->commit();
+		permFile->commit();
+	}
+	else {
+		save_results<point_t>(options, fileName, pointsBuffer);
+		save_results<std::uint64_t>(options, permFileName, permBuffer);
+	}
+}
+
+
+
+/*
+ * \brief Save statistics of the clusters as CSV (one line per cluster, empty clusters have no bounding box).
+ */
+void save_stats(const std::string &fileName, array_view<const cluster_stats_t> stats)
+{
+	std::FILE *fp = std::fopen(fileName.c_str(), "w");
+	if (fp == nullptr)
+		throw (bpp::RuntimeError() << "File '" << fileName << "' cannot be opened for writing.");
+
+	bool ok = std::fprintf(fp, "cluster,count,sse,min_x,min_y,max_x,max_y\n") > 0;
+	for (std::size_t i = 0; i < stats.size() && ok; ++i) {
+		const cluster_stats_t &s = stats[i];
+		if (s.count > 0)
+			ok = std::fprintf(fp, "%zu,%llu,%.17g,%lld,%lld,%lld,%lld\n", i, (unsigned long long)s.count, s.sse(),
+				(long long)s.minX, (long long)s.minY, (long long)s.maxX, (long long)s.maxY) > 0;
+		else
+			ok = std::fprintf(fp, "%zu,0,0,,,,\n", i) > 0;
+	}
+
+	ok = (std::fclose(fp) == 0) && ok;
+	if (!ok)
+		throw (bpp::RuntimeError() << "Error while writing data to file '" << fileName << "'.");
+}
+
+
 
 // Main routine that performs the computation.
 template<bool DEBUG>
-void runKmeans(const std::vector<point_t> &points, std::size_t k, std::size_t iters,
-	std::vector<point_t> &centroids, std::vector<std::uint8_t> &assignments)
+void runKmeans(array_view<const point_t> points, std::size_t k, std::size_t iters,
+	array_view<point_t> centroids, array_view<std::uint8_t> assignments, array_view<cluster_stats_t> stats,
+	array_view<std::uint8_t> second, array_view<std::uint64_t> margins, PhaseTimers *timers, TaskTrace *trace, WorkStats *work,
+	std::vector<assignment_counters_t> &counters)
 {
 	// Initialize distance functor.
 	KMeans<point_t, std::uint8_t, DEBUG> kMeans;
-	kMeans.init(points.size(), k, iters);
-	
-	// Preallocate results.
-	centroids.clear();
-	centroids.reserve(k);
-	assignments.reserve(points.size());
-		
+	{
+		ScopedTimer initTimer(timers, "init");
+		kMeans.init(points.size(), k, iters);
+	}
+	kMeans.collectStatistics(stats);
+	kMeans.collectSecondNearest(second, margins);
+	kMeans.setTimers(timers);
+	kMeans.setTrace(trace);
+	kMeans.setWorkStats(work);
+
+	if (centroids.size() != k)
+		throw (bpp::RuntimeError() << "Invalid number of centroids (" << centroids.size() <<", but " << k << "expected).");
+	if (assignments.size() != points.size())
+		throw (bpp::RuntimeError() << "Invalid number of assignments (" << assignments.size() <<", but " << points.size() << "expected).");
+
 	// Compute the distance.
 	bpp::Stopwatch stopwatch(true);
-	kMeans.compute(points, k, iters, centroids, assignments);
+	{
+		ScopedTimer computeTimer(timers, "compute");
+		kMeans.compute(points, k, iters, centroids, assignments);
+	}
+	stopwatch.stop();
+	counters = kMeans.assignmentCounters();
+
+	std::cout << stopwatch.getMiliseconds() << std::endl;
+}
+
+
+/*
+ * \brief Estimate memory used by the computation (in bytes): the loaded points, allocations of
+ *		the implementation and the results with the additional outputs (unless they are mapped).
+ */
+std::size_t estimate_memory(const Options &options, std::size_t loadedBytes, std::size_t points, std::size_t k)
+{
+	std::size_t res = loadedBytes + KMeans<point_t, std::uint8_t, false>().memoryEstimate(points, k);
+	if (!options.mmapOut)
+		res += k * sizeof(point_t) + points * sizeof(std::uint8_t)
+			+ (options.secondFile.empty() ? 0 : points * (sizeof(std::uint64_t) + sizeof(std::uint8_t)));
+	if (!options.membersFile.empty() || !options.sortedFile.empty())
+		res += (k + 1 + points) * sizeof(std::uint64_t);
+	if (!options.sortedFile.empty())
+		res += points * sizeof(point_t);
+	return res;
+}
+
+
+/*
+ * \brief Print peak RSS, heap allocations (in total and per phase) and the estimated memory.
+ */
+void print_memory(const PhaseTimers &timers, std::size_t estimate)
+{
+	const double MB = 1024.0 * 1024.0;
+	allocation_counters_t &counters = allocation_counters();
+	std::cout << "peak RSS: " << (double)peak_rss() / MB << " MB, estimate: " << (double)estimate / MB << " MB" << std::endl;
+	std::cout << "heap: " << counters.allocations.load() << " allocations, " << (double)counters.allocated.load() / MB
+		<< " MB allocated, peak " << (double)counters.peak.load() / MB << " MB" << std::endl;
+	timers.writeAllocations(std::cout);
+}
+
+
+/*
+ * \brief Print the work counters of the assignment of every iteration and compare the distance
+ *		evaluations with the naive search (n*k).
+ */
+void print_counters(const std::vector<assignment_counters_t> &counters, std::size_t points, std::size_t k)
+{
+	double naive = (double)points * (double)k;
+	std::cout << "iteration\tdistances\tpruned\tskipped\tof naive" << std::endl;
+	for (std::size_t i = 0; i < counters.size(); ++i)
+		std::cout << i << "\t" << counters[i].distances << "\t" << counters[i].pruned << "\t" << counters[i].skipped
+			<< "\t" << (naive > 0.0 ? (double)counters[i].distances / naive * 100.0 : 0.0) << " %" << std::endl;
+}
+
+
+/*
+ * \brief Print achieved bandwidth and distance throughput of every iteration (from the phase timers)
+ *		and compare the throughput with the roofline of the machine, i.e., the lower of the measured
+ *		peak bandwidth times the arithmetic intensity of the implementation and the measured peak
+ *		distance throughput.
+ */
+void print_roofline(const PhaseTimers &timers, std::size_t points, std::size_t k)
+{
+	iteration_work_t work(points, k, KMeans<point_t, std::uint8_t, false>().iterationTraffic(points, k));
+	double bandwidthPeak = measure_peak_bandwidth();
+	double computePeak = measure_peak_distances(k);
+	double memoryRoof = bandwidthPeak * work.intensity();
+	double roof = std::min(memoryRoof, computePeak);
+	std::cout << "peak bandwidth: " << bandwidthPeak << " GB/s, peak compute: " << computePeak << " Gdist/s" << std::endl;
+	std::cout << "per iteration: " << work.bytes * 1e-6 << " MB, " << work.distances * 1e-6 << " M distances ("
+		<< work.intensity() << " dist/B), roof: " << roof << " Gdist/s (" << (memoryRoof < computePeak ? "memory" : "compute")
+		<< " bound)" << std::endl;
+
+	std::vector<double> iterations = timers.samples("compute/iteration");
+	for (std::size_t i = 0; i < iterations.size(); ++i) {
+		double seconds = iterations[i] * 1e-3;
+		double bandwidth = (seconds > 0.0) ? work.bytes / seconds * 1e-9 : 0.0;
+		double throughput = (seconds > 0.0) ? work.distances / seconds * 1e-9 : 0.0;
+		std::cout << "iteration " << i << ": " << iterations[i] << " ms, " << bandwidth << " GB/s, "
+			<< throughput << " Gdist/s (" << (roof > 0.0 ? throughput / roof * 100.0 : 0.0) << " % of roof)" << std::endl;
+	}
+}
+
+
+#ifdef KMEANS_OUT_OF_CORE
+// Main routine for data that are streamed from the file (out-of-core computation).
+template<bool DEBUG>
+void runOutOfCoreKmeans(const std::string &pointsFile, std::size_t k, std::size_t iters,
+	std::size_t chunkSize, std::vector<point_t> &centroids, const std::string &assignmentsFile)
+{
+	OutOfCoreKMeans<point_t, std::uint8_t, DEBUG> kMeans(chunkSize);
+
+	bpp::Stopwatch stopwatch(true);
+	kMeans.compute(pointsFile, k, iters, centroids, assignmentsFile);
 	stopwatch.stop();
 	if (centroids.size() != k)
 		throw (bpp::RuntimeError() << "Invalid number of centroids (" << centroids.size() <<", but " << k << "expected).");
-	if (assignments.size() != points.size())
-		throw (bpp::RuntimeError() << "Invalid number of assignments (" << assignments.size() <<", but " << points.size() << "expected).");
 
 	std::cout << stopwatch.getMiliseconds() << std::endl;
 }
+#endif
 
 
 /*
@@ -128,11 +676,21 @@ int main(int argc, char **argv)
 {
 	// Process arguments.
 	--argc; ++argv;
-	bool debug = false;
-	if (argc == 6 && std::string(*argv) == std::string("-debug")) {
-		--argc; ++argv;
-		debug = true;
+	Options options;
+	try {
+		while (argc > 0 && argv[0][0] == '-' && argv[0][1] != 0) {
+			if (!options.parse(argv[0])) {
+				print_usage();
+				return 0;
+			}
+			--argc; ++argv;
+		}
 	}
+	catch (std::exception&) {
+		print_usage();
+		return 0;
+	}
+	bool debug = options.debug;
 
 	if (argc != 5) {
 		print_usage();
@@ -146,10 +704,129 @@ int main(int argc, char **argv)
 		return 0;
 	}
 
+	bool sharded = !options.columns && is_sharded_input(argv[0]);
+	options.text = options.text || (!sharded && is_text_file(argv[0]));
+	if (options.text && options.outOfCore) {
+		std::cerr << "Error: Text input cannot be streamed (convert it to a binary format first)." << std::endl;
+		print_usage();
+		return 1;
+	}
+	if (std::string(argv[0]) == "-" && (options.outOfCore || options.mmap || options.columns)) {
+		std::cerr << "Error: Standard input is read sequentially, it cannot be mapped, streamed or split into columns." << std::endl;
+		print_usage();
+		return 1;
+	}
+	if (sharded && (options.outOfCore || options.mmap || options.mmapOut)) {
+		std::cerr << "Error: Sharded input is always loaded, it cannot be mapped or streamed (nor its outputs)." << std::endl;
+		print_usage();
+		return 1;
+	}
+	if (options.outOfCore && (!options.membersFile.empty() || !options.sortedFile.empty() || !options.statsFile.empty()
+		|| !options.secondFile.empty() || !options.timersFile.empty() || options.perf || options.roofline || options.workers || !options.traceFile.empty() || options.memory || options.memoryLimit > 0 || options.counters)) {
+		std::cerr << "Error: Cluster members, sorted points, statistics, second-nearest clusters, phase times (or counters), traces" << std::endl;
+		std::cerr << "       and memory reports (or limits) are not available in out-of-core computation." << std::endl;
+		print_usage();
+		return 1;
+	}
+	if (options.counters && !WORK_COUNTERS) {
+		std::cerr << "Error: Work counters are not compiled in (build with -DKMEANS_WORK_COUNTERS)." << std::endl;
+		return 1;
+	}
+	if (options.outOfCore && options.mmapOut) {
+		std::cerr << "Error: Out-of-core computation writes its outputs as it goes, they cannot be mapped." << std::endl;
+		print_usage();
+		return 1;
+	}
+	if (options.columns && (options.outOfCore || options.mmap)) {
+		std::cerr << "Error: Column files are always mapped and cannot be streamed (convert them to a columnar dataset file)." << std::endl;
+		print_usage();
+		return 1;
+	}
+
+	// The points are streamed directly from the file, no loading.
+	if (options.outOfCore) {
+		std::vector<point_t> centroids;
+		try {
+#ifdef KMEANS_OUT_OF_CORE
+			if (debug)
+				runOutOfCoreKmeans<true>(argv[0], k, iters, options.chunkSize, centroids, argv[4]);
+			else
+				runOutOfCoreKmeans<false>(argv[0], k, iters, options.chunkSize, centroids, argv[4]);
+#else
+			throw bpp::RuntimeError("Out-of-core computation is not available in this build.");
+#endif
+			save_results<point_t>(options, argv[3], centroids);
+		}
+		catch (std::exception &e) {
+			std::cout << "FAILED" << std::endl;
+			std::cerr << e.what() << std::endl;
+			return 2;
+		}
+		return 0;
+	}
+
+	// Check the memory limit before the points are loaded, their number is taken from the files.
+	if (options.memoryLimit > 0) {
+		try {
+			std::size_t count = 0;
+			for (const std::string &fileName : sharded ? expand_shards(argv[0]) : std::vector<std::string>{ argv[0] }) {
+				std::size_t shardCount = input_points(options, fileName);
+				count = (count == UNKNOWN_SHARD_SIZE || shardCount == UNKNOWN_SHARD_SIZE) ? UNKNOWN_SHARD_SIZE : count + shardCount;
+			}
+			if (count != UNKNOWN_SHARD_SIZE && !check_memory_limit(options,
+				estimate_memory(options, input_in_place(options, argv[0]) ? 0 : count * sizeof(point_t), count, k)))
+				return 1;
+		}
+		catch (std::exception &e) {
+			std::cerr << "Error: " << e.what() << std::endl;
+			print_usage();
+			return 1;
+		}
+	}
+
 	// Load files.
 	std::vector<point_t> points;
+	std::unique_ptr<MappedFile> mappedPoints;
+	std::vector<std::size_t> shardOffsets;
+	array_view<const point_t> pointsView;
+	PhaseTimers phaseTimers;
+	PhaseTimers *timers = (options.timersFile.empty() && !options.perf && !options.roofline && !options.memory) ? nullptr : &phaseTimers;
+	if (timers != nullptr || options.memoryLimit > 0)
+		allocation_counters().enabled = true;	// the allocations are counted only if they may be reported
+
+	// Hardware counters are inherited by threads, so they are opened before any workers are started.
+	std::unique_ptr<PerfCounters> perfCounters;
+	if (options.perf) {
+		perfCounters.reset(new PerfCounters());
+		if (!perfCounters->error().empty())
+			std::cerr << "Warning: " << perfCounters->error() << std::endl;
+		if (perfCounters->available())
+			phaseTimers.setCounters(perfCounters.get());
+		else
+			std::cerr << "Warning: Hardware counters are not available, only the times are measured." << std::endl;
+	}
+	bpp::Stopwatch loadStopwatch(true);
 	try {
-		load_file(argv[0], points);
+		ScopedTimer loadTimer(timers, "load");
+		if (sharded) {
+			load_shards(expand_shards(argv[0]), [&](const std::string &fileName) {
+				return count_points(options, fileName);
+			}, read_points, [&](const std::string &fileName, std::vector<point_t> &res) {
+				Options shardOptions = options;
+				shardOptions.text = options.text || is_text_file(fileName);
+				load_points(shardOptions, fileName, res);
+			}, points, shardOffsets);
+			pointsView = points;
+		}
+		else if (options.mmap) {
+			mappedPoints.reset(new MappedFile(argv[0]));
+			pointsView = map_points(options, argv[0], *mappedPoints, points);
+		}
+		else {
+			load_points(options, argv[0], points);
+			pointsView = points;
+		}
+		loadStopwatch.stop();
 	}
 	catch (std::exception &e) {
 		std::cerr << "Error: " << e.what() << std::endl;
@@ -158,18 +835,114 @@ int main(int argc, char **argv)
 	}
 
 
-	// Run the algorithm.
+	// Check the memory limit once more with the actual size of the points (the only check for the standard input).
+	std::size_t memoryEstimate = estimate_memory(options, points.capacity() * sizeof(point_t), pointsView.size(), k);
+	if (!check_memory_limit(options, memoryEstimate))
+		return 1;
+
+
+	// Run the algorithm. The results are stored either into vectors or directly into mapped output files.
 	std::vector<point_t> centroids;
 	std::vector<std::uint8_t> assignment;
+	std::unique_ptr<MappedOutputFile> mappedCentroids, mappedAssignment;
 	try {
+		array_view<point_t> centroidsView;
+		array_view<std::uint8_t> assignmentView;
+		if (options.mmapOut) {
+			mappedCentroids.reset(new MappedOutputFile(argv[3], k * sizeof(point_t)));
+			mappedAssignment.reset(new MappedOutputFile(argv[4], pointsView.size() * sizeof(std::uint8_t)));
+			centroidsView = mappedCentroids->view<point_t>();
+			assignmentView = mappedAssignment->view<std::uint8_t>();
+		}
+		else {
+			centroids.resize(k);
+			assignment.resize(pointsView.size());
+			centroidsView = centroids;
+			assignmentView = assignment;
+		}
+
+		std::vector<cluster_stats_t> stats(options.statsFile.empty() ? 0 : k);
+		std::unique_ptr<TaskTrace> trace(options.traceFile.empty() ? nullptr : new TaskTrace());
+		std::unique_ptr<WorkStats> work(options.workers ? new WorkStats() : nullptr);
+		std::vector<assignment_counters_t> counters;
+
+		// Second-nearest clusters file holds the margins followed by the cluster indices.
+		std::size_t secondSize = options.secondFile.empty() ? 0 : pointsView.size() * (sizeof(std::uint64_t) + sizeof(std::uint8_t));
+		std::unique_ptr<MappedOutputFile> mappedSecond;
+		std::vector<char> secondBuffer;
+		char *secondData = nullptr;
+		if (secondSize > 0 && options.mmapOut) {
+			mappedSecond.reset(new MappedOutputFile(options.secondFile, secondSize));
+			secondData = mappedSecond->view<char>().data();
+		}
+		else if (secondSize > 0) {
+			secondBuffer.resize(secondSize);
+			secondData = secondBuffer.data();
+		}
+		array_view<std::uint64_t> margins((std::uint64_t*)secondData, secondSize ? pointsView.size() : 0);
+		array_view<std::uint8_t> second((std::uint8_t*)(secondData + margins.size() * sizeof(std::uint64_t)), margins.size());
+
 		if (debug)
-			runKmeans<true>(points, k, iters, centroids, assignment);
+			runKmeans<true>(pointsView, k, iters, centroidsView, assignmentView, stats, second, margins, timers, trace.get(), work.get(), counters);
 		else
-			runKmeans<false>(points, k, iters, centroids, assignment);
-		
+			runKmeans<false>(pointsView, k, iters, centroidsView, assignmentView, stats, second, margins, timers, trace.get(), work.get(), counters);
+		if (work)
+			work->writeSummary(std::cout);
+		if (options.counters)
+			print_counters(counters, pointsView.size(), k);
+
 		// Save outputs.
-		save_file(argv[3], centroids);
-		save_file(argv[4], assignment);
+		bpp::Stopwatch saveStopwatch(true);
+		{
+			ScopedTimer saveTimer(timers, "save");
+			if (!options.membersFile.empty())
+				save_members(options, options.membersFile, k, assignmentView);
+			if (!options.sortedFile.empty())
+				save_sorted(options, options.sortedFile, k, pointsView, assignmentView);
+			if (!options.statsFile.empty())
+				save_stats(options.statsFile, stats);
+			if (options.mmapOut) {
+				mappedCentroids->commit();
+				mappedAssignment->commit();
+				if (mappedSecond)
+					mappedSecond->commit();
+			}
+			else {
+				save_results<point_t>(options, argv[3], centroids);
+				if (sharded)
+					save_shards<std::uint8_t>(argv[4], shardOffsets, assignment, [&](const std::string &fileName, array_view<const std::uint8_t> data) {
+						save_results<std::uint8_t>(options, fileName, data);
+					});
+				else
+					save_results<std::uint8_t>(options, argv[4], assignment);
+				if (!options.secondFile.empty())
+					save_results<char>(options, options.secondFile, secondBuffer);
+			}
+		}
+		saveStopwatch.stop();
+
+		if (options.timing) {
+			std::cout << "load: " << loadStopwatch.getMiliseconds() << " ms" << std::endl;
+			std::cout << "save: " << saveStopwatch.getMiliseconds() << " ms" << std::endl;
+		}
+		if (options.perf)
+			phaseTimers.writeCounters(std::cout, pointsView.size());
+		if (options.memory)
+			print_memory(phaseTimers, memoryEstimate);
+		if (options.roofline)	// after the memory report, the measurement of the peaks allocates large arrays
+			print_roofline(phaseTimers, pointsView.size(), k);
+		if (!options.timersFile.empty()) {
+			std::ofstream out(options.timersFile);
+			timers->writeJson(out);
+			if (!out)
+				throw (bpp::RuntimeError() << "Error while writing phase times to file '" << options.timersFile << "'.");
+		}
+		if (trace) {
+			std::ofstream out(options.traceFile);
+			trace->writeJson(out);
+			if (!out)
+				throw (bpp::RuntimeError() << "Error while writing trace to file '" << options.traceFile << "'.");
+		}
 	}
 	catch (std::exception &e) {
 		std::cout << "FAILED" << std::endl;
@@ -0,0 +1,472 @@
+#define _CRT_SECURE_NO_WARNINGS
+/*
+ * Microbenchmarks of the k-means kernels (distance, nearest cluster search, cluster reduction)
+ * and of the file loaders. The kernels are swept over the number of points and clusters,
+ * distributions and layouts of the data, with warm and cold caches.
+ */
+#include <implementation.hpp>
+
+#include <exception.hpp>
+#include <stopwatch.hpp>
+#include <interface.hpp>
+#include <mapped_file.hpp>
+#include <parallel_io.hpp>
+#include <dataset.hpp>
+#include <text_points.hpp>
+
+#include <vector>
+#include <string>
+#include <random>
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+
+typedef KMeans<point_t, std::uint8_t, false> kmeans_t;
+
+
+void print_usage()
+{
+	std::cout << "Arguments: [ options ]" << std::endl;
+	std::cout << "  -quick             - small sweep (one size and number of clusters) which takes a few seconds" << std::endl;
+	std::cout << "  -reps=<count>      - number of measured repetitions of every configuration (default 10)" << std::endl;
+	std::cout << "  -kernel=<list>     - comma-separated names of the kernels to run (default all)" << std::endl;
+	std::cout << "                       (distance, nearest, nearest2, reduce, load-raw, load-dataset, load-columnar, load-text)" << std::endl;
+	std::cout << "  -n=<list>          - comma-separated numbers of points (default 65536,1048576)" << std::endl;
+	std::cout << "  -k=<list>          - comma-separated numbers of clusters (default 4,32,256)" << std::endl;
+	std::cout << "  -dir=<directory>   - directory for the temporary files of the loaders (default /tmp)" << std::endl;
+}
+
+
+const char* const KERNELS[] = { "distance", "nearest", "nearest2", "reduce", "load-raw", "load-dataset", "load-columnar", "load-text" };
+
+
+/*
+ * \brief Settings of the sweep given as arguments.
+ */
+struct BenchOptions
+{
+	std::size_t repetitions = 10;
+	std::vector<std::string> kernels;	///< Selected kernels (empty means all).
+	std::vector<std::size_t> sizes = { 64*1024, 1024*1024 };
+	std::vector<std::size_t> clusters = { 4, 32, 256 };
+	std::string dir = "/tmp";
+
+	static std::vector<std::size_t> parseList(const std::string &str)
+	{
+		std::vector<std::size_t> res;
+		std::size_t begin = 0;
+		while (begin < str.length()) {
+			std::size_t end = std::min(str.find(',', begin), str.length());
+			res.push_back((std::size_t)std::stoul(str.substr(begin, end - begin)));
+			begin = end + 1;
+		}
+		if (res.empty() || std::find(res.begin(), res.end(), 0) != res.end())
+			throw bpp::RuntimeError("Invalid list of numbers.");
+		return res;
+	}
+
+	static std::vector<std::string> parseKernels(const std::string &str)
+	{
+		std::vector<std::string> res;
+		std::size_t begin = 0;
+		while (begin <= str.length()) {
+			std::size_t end = std::min(str.find(',', begin), str.length());
+			res.push_back(str.substr(begin, end - begin));
+			if (std::find(std::begin(KERNELS), std::end(KERNELS), res.back()) == std::end(KERNELS))
+				throw (bpp::RuntimeError() << "Unknown kernel '" << res.back() << "'.");
+			begin = end + 1;
+		}
+		return res;
+	}
+
+	bool parse(const std::string &arg)
+	{
+		std::string name = arg.substr(0, arg.find('='));
+		std::string value = (name.length() < arg.length()) ? arg.substr(name.length() + 1) : std::string();
+
+		if (name == "-quick" && value.empty()) {
+			sizes = { 64*1024 };
+			clusters = { 32 };
+		}
+		else if (name == "-reps" && !value.empty())
+			repetitions = std::max<std::size_t>((std::size_t)std::stoul(value), 2);
+		else if (name == "-kernel" && !value.empty())
+			kernels = parseKernels(value);
+		else if (name == "-n" && !value.empty())
+			sizes = parseList(value);
+		else if (name == "-k" && !value.empty())
+			clusters = parseList(value);
+		else if (name == "-dir" && !value.empty())
+			dir = value;
+		else
+			return false;
+		return true;
+	}
+
+	bool selected(const std::string &name) const
+	{
+		return kernels.empty() || std::find(kernels.begin(), kernels.end(), name) != kernels.end();
+	}
+};
+
+
+
+/*
+ * Data generation
+ */
+
+const char* const DISTRIBUTIONS[] = { "uniform", "clustered", "skewed" };
+
+
+/*
+ * \brief Generate points of given distribution (deterministically). The coordinates are limited
+ *		to +-2^29, so the squared distances cannot overflow.
+ * \param distribution Uniform in a square, 32 gaussian blobs, or 90% of the points in one blob.
+ */
+std::vector<point_t> generate_points(std::size_t count, const std::string &distribution)
+{
+	const double range = (double)(1 << 29);
+	std::mt19937_64 random(count);
+	std::uniform_real_distribution<double> uniform(-range, range);
+	std::normal_distribution<double> normal(0.0, range / 64.0);
+
+	std::vector<point_t> blobs(32);
+	for (auto &blob : blobs) {
+		blob.x = (point_t::coord_t)(uniform(random) * 0.9);
+		blob.y = (point_t::coord_t)(uniform(random) * 0.9);
+	}
+
+	std::vector<point_t> res(count);
+	for (auto &point : res) {
+		bool blob = distribution == "clustered" || (distribution == "skewed" && random() % 10 != 0);
+		if (blob) {
+			const point_t &center = (distribution == "skewed") ? blobs[0] : blobs[random() % blobs.size()];
+			point.x = center.x + (point_t::coord_t)std::max(-range * 0.1, std::min(range * 0.1, normal(random)));
+			point.y = center.y + (point_t::coord_t)std::max(-range * 0.1, std::min(range * 0.1, normal(random)));
+		}
+		else {
+			point.x = (point_t::coord_t)uniform(random);
+			point.y = (point_t::coord_t)uniform(random);
+		}
+	}
+	return res;
+}
+
+
+/*
+ * \brief Reorder the points by their nearest centroids (the "sorted" layout makes the nearest
+ *		cluster search predictable, the "random" one is the order of generation).
+ */
+void sort_by_clusters(std::vector<point_t> &points, array_view<const point_t> centroids)
+{
+	std::vector<std::pair<std::size_t, point_t>> keyed(points.size());
+	for (std::size_t i = 0; i < points.size(); ++i)
+		keyed[i] = std::make_pair(kmeans_t::getNearestCluster(points[i], centroids), points[i]);
+	std::stable_sort(keyed.begin(), keyed.end(), [](const std::pair<std::size_t, point_t> &a, const std::pair<std::size_t, point_t> &b) {
+		return a.first < b.first;
+	});
+	for (std::size_t i = 0; i < points.size(); ++i)
+		points[i] = keyed[i].second;
+}
+
+
+
+/*
+ * Measurements
+ */
+
+volatile std::uint64_t sink;	///< Results of the kernels are stored here, so they cannot be optimized out.
+
+
+/*
+ * \brief Evict the data from the CPU caches by streaming through a buffer larger than the last level cache.
+ */
+void flush_caches()
+{
+	static std::vector<std::uint64_t> buffer(64*1024*1024 / sizeof(std::uint64_t));
+	std::uint64_t sum = 0;
+	for (std::size_t i = 0; i < buffer.size(); i += 8) {
+		buffer[i] += 1;
+		sum += buffer[i];
+	}
+	sink = sum;
+}
+
+
+/*
+ * \brief Drop a file from the page cache (best effort, the file must not have dirty pages).
+ */
+void drop_file_cache(const std::string &fileName)
+{
+	int fd = ::open(fileName.c_str(), O_RDONLY);
+	if (fd < 0)
+		return;
+	::fdatasync(fd);
+	::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	::close(fd);
+}
+
+
+/*
+ * \brief Mean and 95% confidence interval (half-width, Student's t) of the samples.
+ */
+struct estimate_t
+{
+	double mean = 0.0;
+	double interval = 0.0;
+
+	estimate_t(const std::vector<double> &samples)
+	{
+		static const double t95[] = { 0.0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+			2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086 };
+
+		for (double sample : samples) mean += sample;
+		mean /= (double)samples.size();
+		if (samples.size() < 2)
+			return;
+
+		double variance = 0.0;
+		for (double sample : samples) variance += (sample - mean) * (sample - mean);
+		variance /= (double)(samples.size() - 1);
+
+		std::size_t df = samples.size() - 1;
+		double t = (df < sizeof(t95) / sizeof(t95[0])) ? t95[df] : 1.96;
+		interval = t * std::sqrt(variance / (double)samples.size());
+	}
+};
+
+
+/*
+ * \brief Configuration of one measurement (printed as a row of the results).
+ */
+struct config_t
+{
+	std::string kernel;
+	std::size_t points;
+	std::size_t k;
+	std::string distribution;
+	std::string layout;
+	bool cold;
+};
+
+
+void print_header()
+{
+	std::cout << "kernel\tn\tk\tdistribution\tlayout\tcache\tns/point\t+-95%\tns/distance\t+-95%" << std::endl;
+}
+
+
+/*
+ * \brief Run a kernel repeatedly and print the time per point and per distance evaluation.
+ * \param prepare Invoked before every repetition (not measured), it evicts caches for cold runs.
+ * \param kernel The measured function.
+ * \param distances Number of distance evaluations of one run (0 if it does not compute distances).
+ */
+void measure(const BenchOptions &options, const config_t &config, std::function<void()> prepare,
+	std::function<void()> kernel, double distances)
+{
+	if (!config.cold)
+		kernel();	// warm-up (not measured)
+
+	std::vector<double> perPoint, perDistance;
+	for (std::size_t r = 0; r < options.repetitions; ++r) {
+		prepare();
+		bpp::Stopwatch stopwatch(true);
+		kernel();
+		stopwatch.stop();
+		double ns = stopwatch.getSeconds() * 1e9;
+		perPoint.push_back(ns / (double)config.points);
+		if (distances > 0.0)
+			perDistance.push_back(ns / distances);
+	}
+
+	estimate_t point(perPoint);
+	std::cout << config.kernel << "\t" << config.points << "\t" << config.k << "\t" << config.distribution << "\t"
+		<< config.layout << "\t" << (config.cold ? "cold" : "warm") << "\t" << std::fixed << std::setprecision(3)
+		<< point.mean << "\t" << point.interval;
+	if (distances > 0.0) {
+		estimate_t distance(perDistance);
+		std::cout << "\t" << distance.mean << "\t" << distance.interval;
+	}
+	else
+		std::cout << "\t-\t-";
+	std::cout << std::defaultfloat << std::endl;
+}
+
+
+
+/*
+ * Kernels
+ */
+
+/*
+ * \brief In-memory kernels: distance, nearest cluster search (also with the second-nearest one)
+ *		and the reduction of the clusters.
+ */
+void bench_kernels(const BenchOptions &options, std::size_t n, std::size_t k, const std::string &distribution,
+	const std::string &layout, bool cold)
+{
+	std::vector<point_t> points = generate_points(n, distribution);
+	std::vector<point_t> centroids(points.begin(), points.begin() + std::min(k, n));	// as the algorithm starts
+	if (layout == "sorted")
+		sort_by_clusters(points, centroids);
+
+	auto prepare = [&]() {
+		if (cold) flush_caches();
+	};
+	config_t config = { "", n, centroids.size(), distribution, layout, cold };
+
+	if (options.selected("distance")) {
+		config.kernel = "distance";
+		measure(options, config, prepare, [&]() {
+			std::uint64_t sum = 0;
+			for (std::size_t i = 0; i < points.size(); ++i)
+				sum += (std::uint64_t)kmeans_t::distance(points[i], centroids[i % centroids.size()]);
+			sink = sum;
+		}, (double)n);
+	}
+
+	if (options.selected("nearest")) {
+		config.kernel = "nearest";
+		measure(options, config, prepare, [&]() {
+			std::uint64_t sum = 0;
+			for (std::size_t i = 0; i < points.size(); ++i)
+				sum += kmeans_t::getNearestCluster(points[i], centroids);
+			sink = sum;
+		}, (double)n * (double)centroids.size());
+	}
+
+	if (options.selected("nearest2")) {
+		config.kernel = "nearest2";
+		measure(options, config, prepare, [&]() {
+			std::uint64_t sum = 0;
+			for (std::size_t i = 0; i < points.size(); ++i) {
+				std::size_t second;
+				std::uint64_t margin;
+				sum += get_nearest_clusters<point_t>(points[i], centroids, kmeans_t::distance, second, margin) + second + margin;
+			}
+			sink = sum;
+		}, (double)n * (double)centroids.size());
+	}
+
+	if (options.selected("reduce")) {
+		// The points are distributed into the clusters as the assignment step does it.
+		std::vector<kmeans_t::cluster_points_t> clusters(centroids.size());
+		for (const point_t &point : points)
+			clusters[kmeans_t::getNearestCluster(point, centroids)].push_back(point);
+
+		kmeans_t kMeans;
+		config.kernel = "reduce";
+		measure(options, config, prepare, [&]() {
+			std::uint64_t sum = 0;
+			for (const auto &cluster : clusters) {
+				point_t total = kMeans.sumCluster(cluster);
+				sum += (std::uint64_t)total.x + (std::uint64_t)total.y;
+			}
+			sink = sum;
+		}, 0.0);
+	}
+}
+
+
+/*
+ * \brief File loaders of the formats: raw records (concurrent pread), dataset with records,
+ *		columnar dataset and text. Cold runs drop the file from the page cache first.
+ */
+void bench_loaders(const BenchOptions &options, std::size_t n, const std::string &distribution, bool cold)
+{
+	std::vector<point_t> points = generate_points(n, distribution);
+	std::string base = options.dir + "/kmeans-microbench-" + std::to_string(::getpid());
+
+	struct loader_t
+	{
+		std::string kernel;
+		std::string file;
+		std::function<void()> save;
+		std::function<void(std::vector<point_t>&)> load;
+	};
+
+	std::vector<loader_t> loaders = {
+		{ "load-raw", base + ".raw",
+			[&]() { save_file_parallel<point_t>(base + ".raw", points); },
+			[&](std::vector<point_t> &res) { load_file_parallel(base + ".raw", res); } },
+		{ "load-dataset", base + ".kmp",
+			[&]() { save_dataset(base + ".kmp", points, dataset_header_t::INT64); },
+			[&](std::vector<point_t> &res) { load_dataset(base + ".kmp", res); } },
+		{ "load-columnar", base + ".col.kmp",
+			[&]() { save_dataset(base + ".col.kmp", points, dataset_header_t::INT64, true); },
+			[&](std::vector<point_t> &res) { load_dataset(base + ".col.kmp", res); } },
+		{ "load-text", base + ".csv",
+			[&]() { save_text_points(base + ".csv", points); },
+			[&](std::vector<point_t> &res) {
+				MappedFile file(base + ".csv");
+				parse_text_points(base + ".csv", file.view<char>().data(), file.size(), res);
+			} },
+	};
+
+	for (const loader_t &loader : loaders) {
+		if (!options.selected(loader.kernel))
+			continue;
+
+		loader.save();
+		std::vector<point_t> res;
+		config_t config = { loader.kernel, n, 0, distribution, "file", cold };
+		measure(options, config, [&]() {
+			res.clear();
+			res.shrink_to_fit();
+			if (cold) drop_file_cache(loader.file);
+		}, [&]() {
+			loader.load(res);
+			if (res.size() != n)
+				throw (bpp::RuntimeError() << "Loader " << loader.kernel << " returned " << res.size() << " points instead of " << n << ".");
+		}, 0.0);
+		std::remove(loader.file.c_str());
+	}
+}
+
+
+/*
+ * Application Entry Point
+ */
+int main(int argc, char **argv)
+{
+	BenchOptions options;
+	try {
+		for (int i = 1; i < argc; ++i)
+			if (!options.parse(argv[i])) {
+				print_usage();
+				return 0;
+			}
+	}
+	catch (std::exception&) {
+		print_usage();
+		return 0;
+	}
+
+	try {
+		print_header();
+		for (std::size_t n : options.sizes)
+			for (const char *distribution : DISTRIBUTIONS)
+				for (bool cold : { false, true }) {
+					for (std::size_t k : options.clusters)
+						for (const char *layout : { "random", "sorted" })
+							bench_kernels(options, n, k, distribution, layout, cold);
+					bench_loaders(options, n, distribution, cold);
+				}
+	}
+	catch (std::exception &e) {
+		std::cout << "FAILED" << std::endl;
+		std::cerr << e.what() << std::endl;
+		return 2;
+	}
+
+	return 0;
+}
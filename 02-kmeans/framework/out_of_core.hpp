@@ -0,0 +1,290 @@
+#ifndef KMEANS_OUT_OF_CORE_HPP
+#define KMEANS_OUT_OF_CORE_HPP
+
+#include <implementation.hpp>
+#include <exception.hpp>
+#include <dataset.hpp>
+#include <compressed.hpp>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <tbb/enumerable_thread_specific.h>
+#include <future>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+
+
+/*
+ * \brief Out-of-core variant of the k-means algorithm. The points are never held in memory
+ *		as a whole, the file is streamed in large chunks in every iteration instead. Reading
+ *		of the next chunk overlaps with the computation on the current one (double buffering).
+ * \note The results are identical to the in-memory KMeans (sums are accumulated exactly).
+ */
+template<typename POINT = point_t, typename ASGN = std::uint8_t, bool DEBUG = false>
+class OutOfCoreKMeans
+{
+private:
+	typedef KMeans<POINT, ASGN, DEBUG> kernel_t;
+
+	/*
+	 * \brief Per-thread partial sums of the clusters.
+	 */
+	struct Accumulator
+	{
+		std::vector<POINT> sums;
+		std::vector<std::size_t> counts;
+
+		Accumulator(std::size_t k = 0) : sums(k), counts(k) {}
+
+		void clear()
+		{
+			for (std::size_t i = 0; i < sums.size(); ++i) {
+				sums[i].x = sums[i].y = 0;
+				counts[i] = 0;
+			}
+		}
+	};
+
+
+	/*
+	 * \brief Sequential reader of point records which can be rewound for every iteration.
+	 */
+	class ChunkReader
+	{
+	private:
+		std::FILE *mFile;
+		std::string mFileName;
+		dataset_header_t mHeader;	///< Describes the records (native ones for raw files).
+		std::size_t mCount;
+		std::size_t mRemaining;		///< Records left until the end of the current pass.
+		long mOffset;				///< Offset of the first record (size of the header).
+		std::vector<char> mRecords;	///< Stored records before conversion (non-native files only).
+		std::unique_ptr<CompressedStream> mStream;	///< Decoder of compressed files.
+
+		/*
+		 * \brief Read a batch of records from a columnar file (one seek and read per column).
+		 */
+		void readColumns(std::vector<POINT> &buffer, std::size_t count)
+		{
+			std::size_t coordSize = dataset_header_t::coordSize(mHeader.coordType);
+			std::size_t position = mCount - mRemaining;
+			mRecords.resize(count * coordSize);
+			for (std::size_t column = 0; column < mHeader.dimension; ++column) {
+				std::fseek(mFile, mOffset + (long)((column * mCount + position) * coordSize), SEEK_SET);
+				if (std::fread(mRecords.data(), coordSize, count, mFile) != count)
+					throw (bpp::RuntimeError() << "Error while reading from file '" << mFileName << "'.");
+				convert_column(mHeader.coordType, mRecords.data(), count, column, buffer.data());
+			}
+		}
+
+	public:
+		/*
+		 * \note The checksum of headered files is not verified when streaming.
+		 */
+		ChunkReader(const std::string &fileName) : mFileName(fileName), mOffset(0)
+		{
+			if (is_compressed_file(fileName)) {
+				mStream.reset(new CompressedStream(fileName));
+				mFile = nullptr;
+				mCount = mStream->count();
+				return;
+			}
+
+			mFile = std::fopen(fileName.c_str(), "rb");
+			if (mFile == nullptr)
+				throw (bpp::RuntimeError() << "File '" << fileName << "' cannot be opened for reading.");
+
+			std::fseek(mFile, 0, SEEK_END);
+			std::size_t fileSize = (std::size_t)std::ftell(mFile);
+			mCount = fileSize / sizeof(POINT);
+			std::fseek(mFile, 0, SEEK_SET);
+
+			dataset_header_t header;
+			if (std::fread(&header, sizeof(header), 1, mFile) == 1 && dataset_header_t::matches(&header, sizeof(header))) {
+				try {
+					header.validate(fileName, fileSize);
+				}
+				catch (...) {
+					std::fclose(mFile);
+					throw;
+				}
+				mHeader = header;
+				mCount = (std::size_t)header.count;
+				mOffset = (long)sizeof(header);
+			}
+			rewind();
+		}
+
+		~ChunkReader()
+		{
+			if (mFile != nullptr)
+				std::fclose(mFile);
+		}
+
+		std::size_t count() const { return mCount; }
+
+		void rewind()
+		{
+			if (mStream) {
+				mStream->rewind();
+				return;
+			}
+			std::fseek(mFile, mOffset, SEEK_SET);
+			mRemaining = mCount;
+		}
+
+		/*
+		 * \brief Read up to buffer.size() records, return how many were actually read.
+		 */
+		std::size_t read(std::vector<POINT> &buffer)
+		{
+			if (mStream)
+				return mStream->read(buffer.data(), buffer.size());
+
+			std::size_t count = std::min(buffer.size(), mRemaining);
+			if (mHeader.columnar()) {
+				readColumns(buffer, count);
+				mRemaining -= count;
+				return count;
+			}
+
+			void *target = buffer.data();
+			if (!mHeader.native()) {
+				mRecords.resize(count * mHeader.recordSize());
+				target = mRecords.data();
+			}
+
+			if (std::fread(target, mHeader.recordSize(), count, mFile) != count)
+				throw (bpp::RuntimeError() << "Error while reading from file '" << mFileName << "'.");
+			if (!mHeader.native())
+				convert_records(mHeader, mRecords.data(), count, buffer.data());
+
+			mRemaining -= count;
+			return count;
+		}
+	};
+
+
+	std::size_t mChunkSize;
+	std::vector<POINT> mBuffers[2];
+	std::vector<ASGN> mAssignments;
+
+
+	/*
+	 * \brief Assign points of one chunk to the nearest centroids and accumulate the sums.
+	 */
+	void processChunk(const std::vector<POINT> &chunk, std::size_t count, const std::vector<POINT> &centroids,
+		tbb::enumerable_thread_specific<Accumulator> &accumulators, bool storeAssignments)
+	{
+		tbb::parallel_for(
+			tbb::blocked_range<std::size_t>(0, count),
+			[&](const tbb::blocked_range<std::size_t> &range) {
+				Accumulator &acc = accumulators.local();
+				for (std::size_t i = range.begin(); i != range.end(); ++i) {
+					std::size_t nearest = kernel_t::getNearestCluster(chunk[i], centroids);
+					if (storeAssignments) mAssignments[i] = (ASGN)nearest;
+					acc.sums[nearest].x += chunk[i].x;
+					acc.sums[nearest].y += chunk[i].y;
+					++acc.counts[nearest];
+				}
+			});
+	}
+
+
+public:
+	/*
+	 * \param chunkSize Number of points read from the file at once (two chunks are kept in memory).
+	 */
+	OutOfCoreKMeans(std::size_t chunkSize = 4*1024*1024) : mChunkSize(chunkSize) {}
+
+
+	/*
+	 * \brief Perform the clustering of points stored in a file and write the point assignment
+	 *		yielded by the last iteration directly into the output file.
+	 * \note First k points are taken as initial centroids for first iteration.
+	 * \param pointsFile Path to the file with input points.
+	 * \param k Number of clusters.
+	 * \param iters Number of refining iterations.
+	 * \param centroids Vector where the final cluster centroids should be stored.
+	 * \param assignmentsFile Path to the file where the final assignment is written.
+	 */
+	void compute(const std::string &pointsFile, std::size_t k, std::size_t iters,
+		std::vector<POINT> &centroids, const std::string &assignmentsFile)
+	{
+		ChunkReader reader(pointsFile);
+		if (reader.count() < k)
+			throw (bpp::RuntimeError() << "File '" << pointsFile << "' holds only " << reader.count() << " points, but " << k << " clusters requested.");
+
+		// Small files need not allocate whole chunks (a chunk must still hold the initial centroids).
+		std::size_t chunkSize = std::max<std::size_t>(std::min(std::max(mChunkSize, k), reader.count()), 1);
+		for (auto &buffer : mBuffers) buffer.resize(chunkSize);
+		mAssignments.resize(chunkSize);
+
+		// Prepare for the first iteration
+		centroids.resize(k);
+		reader.read(mBuffers[0]);
+		for (std::size_t i = 0; i < k; ++i) {
+			centroids[i] = mBuffers[0][i];
+		}
+
+		std::FILE *out = std::fopen(assignmentsFile.c_str(), "wb");
+		if (out == nullptr)
+			throw (bpp::RuntimeError() << "File '" << assignmentsFile << "' cannot be opened for writing.");
+
+		Accumulator exemplar(k);
+		tbb::enumerable_thread_specific<Accumulator> accumulators(exemplar);
+
+		// Run the k-means refinements
+		try {
+			while (iters > 0) {
+				--iters;
+				for (auto &acc : accumulators) acc.clear();
+
+				reader.rewind();
+				std::size_t current = 0;
+				std::size_t count = reader.read(mBuffers[current]);
+				while (count > 0) {
+					// Prefetch the next chunk while the current one is being processed.
+					std::future<std::size_t> next = std::async(std::launch::async,
+						[&reader, this, current]() { return reader.read(mBuffers[1 - current]); });
+
+					processChunk(mBuffers[current], count, centroids, accumulators, iters == 0);
+
+					// Final loop, store in the results
+					if (iters == 0 && std::fwrite(mAssignments.data(), sizeof(ASGN), count, out) != count)
+						throw (bpp::RuntimeError() << "Error while writing data to file '" << assignmentsFile << "'.");
+
+					count = next.get();
+					current = 1 - current;
+				}
+
+				Accumulator total(k);
+				for (auto &acc : accumulators) {
+					for (std::size_t i = 0; i < k; ++i) {
+						total.sums[i].x += acc.sums[i].x;
+						total.sums[i].y += acc.sums[i].y;
+						total.counts[i] += acc.counts[i];
+					}
+				}
+
+				for (std::size_t i = 0; i < k; ++i) {
+					if (total.counts[i] == 0) continue;	// If the cluster is empty, keep its previous centroid.
+					centroids[i].x = total.sums[i].x / (std::int64_t)total.counts[i];
+					centroids[i].y = total.sums[i].y / (std::int64_t)total.counts[i];
+				}
+			}
+		}
+		catch (...) {
+			std::fclose(out);
+			throw;
+		}
+
+		if (std::fclose(out) != 0)
+			throw (bpp::RuntimeError() << "Error while writing data to file '" << assignmentsFile << "'.");
+	}
+};
+
+#endif
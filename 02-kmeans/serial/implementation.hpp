@@ -3,6 +3,11 @@
 
 #include <interface.hpp>
 #include <exception.hpp>
+#include <stopwatch.hpp>
+
+#include <iostream>
+#include <limits>
+#include <cmath>
 
 
 
@@ -23,7 +28,7 @@ private:
 		return (coord_t)(dx*dx + dy*dy);
 	}
 
-	static std::size_t getNearestCluster(const POINT &point, const std::vector<POINT> &centroids)
+	static std::size_t getNearestCluster(const POINT &point, array_view<const POINT> centroids)
 	{
 		coord_t minDist = distance(point, centroids[0]);
 		std::size_t nearest = 0;
@@ -40,6 +45,8 @@ private:
 
 
 public:
+	using IKMeans<POINT, ASGN, DEBUG>::compute;
+
 	/*
 	 * \brief Perform the initialization of the functor (e.g., allocate memory buffers).
 	 * \param points Number of points being clustered.
@@ -53,48 +60,108 @@ public:
 	}
 
 
+	/*
+	 * \brief Only the sums and counts of the clusters are allocated.
+	 */
+	virtual std::size_t memoryEstimate(std::size_t points, std::size_t k) const
+	{
+		return k * (sizeof(POINT) + sizeof(std::size_t));
+	}
+
+
+	/*
+	 * \brief Every point is read and its assignment is written.
+	 */
+	virtual std::size_t iterationTraffic(std::size_t points, std::size_t k) const
+	{
+		return points * (sizeof(POINT) + sizeof(ASGN));
+	}
+
+
 	/*
 	 * \brief Perform the clustering and return the cluster centroids and point assignment
 	 *		yielded by the last iteration.
 	 * \note First k points are taken as initial centroids for first iteration.
-	 * \param points Vector with input points.
+	 * \param points View of the input points.
 	 * \param k Number of clusters.
 	 * \param iters Number of refining iterations.
-	 * \param centroids Vector where the final cluster centroids should be stored.
-	 * \param assignments Vector where the final assignment of the points should be stored.
-	 *		The indices should correspond to point indices in 'points' vector.
+	 * \param centroids Preallocated array (of size k) where the final cluster centroids should be stored.
+	 * \param assignments Preallocated array (of size points.size()) where the final assignment of
+	 *		the points should be stored. The indices should correspond to point indices in 'points' view.
 	 */
-	virtual void compute(const std::vector<POINT> &points, std::size_t k, std::size_t iters,
-		std::vector<POINT> &centroids, std::vector<ASGN> &assignments)
+	virtual void compute(array_view<const POINT> points, std::size_t k, std::size_t iters,
+		array_view<POINT> centroids, array_view<ASGN> assignments)
 	{
 		// Prepare for the first iteration
-		centroids.resize(k);
-		assignments.resize(points.size());
 		for (std::size_t i = 0; i < k; ++i)
 			centroids[i] = points[i];
 
 		// Run the k-means refinements
+		std::size_t iteration = 0;
+		this->mAssignmentCounters.clear();
 		while (iters > 0) {
 			--iters;
-
-			// Prepare empty tmp fields.
-			for (std::size_t i = 0; i < k; ++i) {
-				sums[i].x = sums[i].y = 0;
-				counts[i] = 0;
-			}
+			ScopedTimer iterationTimer(this->mTimers, "iteration");
+			bpp::Stopwatch iterationStopwatch;
+			iteration_diagnostics_t diagnostics;
+			if constexpr (DEBUG) iterationStopwatch.start();
+
+			// The sums are accumulated during the assignment (there is no separate reduction phase).
+			{
+				ScopedTimer assignTimer(this->mTimers, "assign");
+
+				// Prepare empty tmp fields.
+				for (std::size_t i = 0; i < k; ++i) {
+					sums[i].x = sums[i].y = 0;
+					counts[i] = 0;
+				}
 			
-			for (std::size_t i = 0; i < points.size(); ++i) {
-				std::size_t nearest = getNearestCluster(points[i], centroids);
-				assignments[i] = (ASGN)nearest;
-				sums[nearest].x += points[i].x;
-				sums[nearest].y += points[i].y;
-				++counts[nearest];
+				// Statistics are gathered in the final loop (if requested).
+				bool collectStats = iters == 0 && !this->mStats.empty();
+				if (collectStats)
+					for (std::size_t i = 0; i < k; ++i)
+						this->mStats[i].clear();
+
+				bool trackSecond = iters == 0 && !this->mSecond.empty();
+				assignment_counters_t counters;
+				for (std::size_t i = 0; i < points.size(); ++i) {
+					std::size_t nearest;
+					if (trackSecond) {
+						std::size_t second;
+						nearest = get_nearest_clusters<POINT>(points[i], centroids, distance, second, this->mMargins[i]);
+						this->mSecond[i] = (ASGN)second;
+					}
+					else
+						nearest = getNearestCluster(points[i], centroids);
+					if constexpr (WORK_COUNTERS) counters.distances += centroids.size();	// the search is exhaustive
+					if constexpr (DEBUG) {
+						diagnostics.sse += (double)distance(points[i], centroids[nearest]);
+						diagnostics.reassigned += (iteration == 0 || assignments[i] != (ASGN)nearest) ? 1 : 0;
+					}
+					assignments[i] = (ASGN)nearest;
+					sums[nearest].x += points[i].x;
+					sums[nearest].y += points[i].y;
+					++counts[nearest];
+					if (collectStats)
+						this->mStats[nearest].add(points[i], (std::uint64_t)distance(points[i], centroids[nearest]));
+				}
+				if constexpr (WORK_COUNTERS) this->mAssignmentCounters.push_back(counters);
 			}
 
+			ScopedTimer updateTimer(this->mTimers, "update");
 			for (std::size_t i = 0; i < k; ++i) {
+				if constexpr (DEBUG) diagnostics.emptyClusters += (counts[i] == 0) ? 1 : 0;
 				if (counts[i] == 0) continue;	// If the cluster is empty, keep its previous centroid.
+				POINT previous = centroids[i];
 				centroids[i].x = sums[i].x / (std::int64_t)counts[i];
 				centroids[i].y = sums[i].y / (std::int64_t)counts[i];
+				if constexpr (DEBUG) diagnostics.maxShift = std::max(diagnostics.maxShift, std::sqrt((double)distance(previous, centroids[i])));
+			}
+
+			if constexpr (DEBUG) {
+				iterationStopwatch.stop();
+				diagnostics.time = iterationStopwatch.getMiliseconds();
+				diagnostics.print(std::cerr, iteration++);
 			}
 		}
 	}